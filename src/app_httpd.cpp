@@ -22,9 +22,27 @@
 #include "fd_forward.h"
 #include "fr_forward.h"
 #include "definations.h"
+#include "profiler.h"
+#include "bench.h"
+#include "tiled_detector.h"
+#include "stream_broadcast.h"
+#include "stream_rate.h"
+#include "stream_roi.h"
+#include "dots_stream.h"
+#include "capture_cache.h"
+#include "raw_frame.h"
+#include "control_ws.h"
+#include "json_writer.h"
+#include "matrix_cache.h"
+#include "face_tracker.h"
+#include "face_worker.h"
+#include "mtmn_tuner.h"
+#include "motion_gate.h"
+#include "background_model.h"
+#include "color_classifier.h"
+#include "morphology.h"
 
 #include <vector>
-#include <list>
 #include <memory>
 
 #define ENROLL_CONFIRM_TIMES 5
@@ -47,16 +65,6 @@ typedef struct {
         int * values; //array to be filled with values
 } ra_filter_t;
 
-typedef struct {
-        httpd_req_t *req;
-        size_t len;
-} jpg_chunking_t;
-
-#define PART_BOUNDARY "123456789000000000000987654321"
-static const char* _STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
-static const char* _STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
-
 static ra_filter_t ra_filter;
 httpd_handle_t stream_httpd = NULL;
 httpd_handle_t camera_httpd = NULL;
@@ -67,6 +75,16 @@ static int8_t recognition_enabled = 0;
 static int8_t is_enrolling = 0;
 static face_id_list id_list = {0};
 
+#define TILED_OFF 0
+#define TILED_ON 1
+#define TILED_AUTO 2
+static int8_t tiled_mode = TILED_AUTO;
+static uint8_t tiled_coarse = TILED_COARSE_STEP;
+// bumped by every control that changes what the detector finds in a frame, so
+// results reused for an unchanged scene are recomputed; guarded by
+// detector_lock
+static uint32_t detector_generation = 0;
+
 static ra_filter_t * ra_filter_init(ra_filter_t * filter, size_t sample_size){
     memset(filter, 0, sizeof(ra_filter_t));
 
@@ -105,31 +123,6 @@ static void rgb_print(dl_matrix3du_t *image_matrix, uint32_t color, const char *
     fb_gfx_print(&fb, (fb.width - (strlen(str) * 14)) / 2, 10, color, str);
 }
 
-static int rgb_printf(dl_matrix3du_t *image_matrix, uint32_t color, const char *format, ...){
-    char loc_buf[64];
-    char * temp = loc_buf;
-    int len;
-    va_list arg;
-    va_list copy;
-    va_start(arg, format);
-    va_copy(copy, arg);
-    len = vsnprintf(loc_buf, sizeof(loc_buf), format, arg);
-    va_end(copy);
-    if(len >= sizeof(loc_buf)){
-        temp = (char*)malloc(len+1);
-        if(temp == NULL) {
-            return 0;
-        }
-    }
-    vsnprintf(temp, len+1, format, arg);
-    va_end(arg);
-    rgb_print(image_matrix, color, temp);
-    if(len > 64){
-        free(temp);
-    }
-    return len;
-}
-
 static void draw_face_boxes(dl_matrix3du_t *image_matrix, box_array_t *boxes, int face_id){
     int x, y, w, h, i;
     uint32_t color = FACE_COLOR_YELLOW;
@@ -166,124 +159,112 @@ static void draw_face_boxes(dl_matrix3du_t *image_matrix, box_array_t *boxes, in
     }
 }
 
+// id_list is shared by the recognition worker and /capture
+static SemaphoreHandle_t face_id_lock = xSemaphoreCreateMutex();
+
+// enrolls or recognizes an aligned face; the face worker's recognizer
+static void recognize_aligned(dl_matrix3du_t *aligned_face, face_result_t *result){
+    xSemaphoreTake(face_id_lock, portMAX_DELAY);
+    if (is_enrolling == 1){
+        int8_t left_sample_face = enroll_face(&id_list, aligned_face);
+
+        if(left_sample_face == (ENROLL_CONFIRM_TIMES - 1)){
+            Serial.printf("Enrolling Face ID: %d\n", id_list.tail);
+        }
+        Serial.printf("Enrolling Face ID: %d sample %d\n", id_list.tail, ENROLL_CONFIRM_TIMES - left_sample_face);
+        result->color = FACE_COLOR_CYAN;
+        snprintf(result->label, sizeof(result->label), "ID[%u] Sample[%u]", id_list.tail, ENROLL_CONFIRM_TIMES - left_sample_face);
+        if (left_sample_face == 0){
+            is_enrolling = 0;
+            Serial.printf("Enrolled Face ID: %d\n", id_list.tail);
+        }
+        result->face_id = 0;
+    } else {
+        result->face_id = recognize_face(&id_list, aligned_face);
+        if (result->face_id >= 0) {
+            Serial.printf("Match Face ID: %u\n", result->face_id);
+            result->color = FACE_COLOR_GREEN;
+            snprintf(result->label, sizeof(result->label), "Hello Subject %u", result->face_id);
+        } else {
+            Serial.println("No Match Found");
+            result->color = FACE_COLOR_RED;
+            snprintf(result->label, sizeof(result->label), "Intruder Alert!");
+            result->face_id = -1;
+        }
+    }
+    xSemaphoreGive(face_id_lock);
+}
+
+// synchronous recognition for /capture, the stream goes through the face worker
 static int run_face_recognition(dl_matrix3du_t *image_matrix, box_array_t *net_boxes){
-    dl_matrix3du_t *aligned_face = NULL;
-    int matched_id = 0;
+    face_result_t result;
+    memset(&result, 0, sizeof(result));
 
-    aligned_face = dl_matrix3du_alloc(1, FACE_WIDTH, FACE_HEIGHT, 3);
+    dl_matrix3du_t *aligned_face = matrix_cache_borrow(FACE_WIDTH, FACE_HEIGHT, 3);
     if(!aligned_face){
         Serial.println("Could not allocate face recognition buffer");
-        return matched_id;
+        return 0;
     }
     if (align_face(net_boxes, image_matrix, aligned_face) == ESP_OK){
-        if (is_enrolling == 1){
-            int8_t left_sample_face = enroll_face(&id_list, aligned_face);
-
-            if(left_sample_face == (ENROLL_CONFIRM_TIMES - 1)){
-                Serial.printf("Enrolling Face ID: %d\n", id_list.tail);
-            }
-            Serial.printf("Enrolling Face ID: %d sample %d\n", id_list.tail, ENROLL_CONFIRM_TIMES - left_sample_face);
-            rgb_printf(image_matrix, FACE_COLOR_CYAN, "ID[%u] Sample[%u]", id_list.tail, ENROLL_CONFIRM_TIMES - left_sample_face);
-            if (left_sample_face == 0){
-                is_enrolling = 0;
-                Serial.printf("Enrolled Face ID: %d\n", id_list.tail);
-            }
-        } else {
-            matched_id = recognize_face(&id_list, aligned_face);
-            if (matched_id >= 0) {
-                Serial.printf("Match Face ID: %u\n", matched_id);
-                rgb_printf(image_matrix, FACE_COLOR_GREEN, "Hello Subject %u", matched_id);
-            } else {
-                Serial.println("No Match Found");
-                rgb_print(image_matrix, FACE_COLOR_RED, "Intruder Alert!");
-                matched_id = -1;
-            }
-        }
+        recognize_aligned(aligned_face, &result);
     } else {
         Serial.println("Face Not Aligned");
         //rgb_print(image_matrix, FACE_COLOR_YELLOW, "Human Detected");
     }
+    matrix_cache_return(aligned_face);
 
-    dl_matrix3du_free(aligned_face);
-    return matched_id;
-}
-
-static size_t jpg_encode_stream(void * arg, size_t index, const void* data, size_t len){
-    jpg_chunking_t *j = (jpg_chunking_t *)arg;
-    if(!index){
-        j->len = 0;
-    }
-    if(httpd_resp_send_chunk(j->req, (const char *)data, len) != ESP_OK){
-        return 0;
+    if(result.label[0]){
+        rgb_print(image_matrix, result.color, result.label);
     }
-    j->len += len;
-    return len;
+    return result.face_id;
 }
 
-static esp_err_t capture_handler(httpd_req_t *req){
+// grabs and encodes a new frame for the /capture cache, with the face boxes
+// drawn in when face detection is on
+static jpeg_frame_t *capture_produce(void *arg){
     camera_fb_t * fb = NULL;
-    esp_err_t res = ESP_OK;
+    jpeg_frame_t * frame = NULL;
     int64_t fr_start = esp_timer_get_time();
 
     fb = esp_camera_fb_get();
     if (!fb) {
         Serial.println("Camera capture failed");
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
+        return NULL;
     }
 
-    httpd_resp_set_type(req, "image/jpeg");
-    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-
-    size_t out_len, out_width, out_height;
-    uint8_t * out_buf;
     bool s;
     bool detected = false;
     int face_id = 0;
-    Serial.printf("format %i", (int)fb->format);
     if(!detection_enabled || fb->width > 400){
-        size_t fb_len = 0;
         if(fb->format == PIXFORMAT_JPEG){
-            fb_len = fb->len;
-            res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
+            frame = jpeg_frame_copy(fb->buf, fb->len, fr_start);
         } else {
-            jpg_chunking_t jchunk = {req, 0};
-            res = frame2jpg_cb(fb, 80, jpg_encode_stream, &jchunk)?ESP_OK:ESP_FAIL;
-            httpd_resp_send_chunk(req, NULL, 0);
-            fb_len = jchunk.len;
+            frame = jpeg_frame_encode(fb->buf, fb->len, fb->width, fb->height, fb->format, 80, fr_start);
         }
-        
-        
         esp_camera_fb_return(fb);
         int64_t fr_end = esp_timer_get_time();
-        Serial.printf("JPG: %uB %ums\n", (uint32_t)(fb_len), (uint32_t)((fr_end - fr_start)/1000));
-        return res;
+        Serial.printf("JPG: %uB %ums\n", frame ? (uint32_t)frame->len : 0, (uint32_t)((fr_end - fr_start)/1000));
+        return frame;
     }
 
-    dl_matrix3du_t *image_matrix = dl_matrix3du_alloc(1, fb->width, fb->height, 3);
+    dl_matrix3du_t *image_matrix = matrix_cache_borrow(fb->width, fb->height, 3);
     if (!image_matrix) {
         esp_camera_fb_return(fb);
-        Serial.println("dl_matrix3du_alloc failed");
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
+        Serial.println("face matrix allocation failed");
+        return NULL;
     }
 
-    out_buf = image_matrix->item;
-    out_len = fb->width * fb->height * 3;
-    out_width = fb->width;
-    out_height = fb->height;
-
-    s = fmt2rgb888(fb->buf, fb->len, fb->format, out_buf);
+    s = fmt2rgb888(fb->buf, fb->len, fb->format, image_matrix->item);
     esp_camera_fb_return(fb);
     if(!s){
-        dl_matrix3du_free(image_matrix);
+        matrix_cache_return(image_matrix);
         Serial.println("to rgb888 failed");
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
+        return NULL;
     }
 
-    box_array_t *net_boxes = face_detect(image_matrix, &mtmn_config);
+    mtmn_config_t config;
+    mtmn_tuner_get_config(&config);
+    box_array_t *net_boxes = face_detect(image_matrix, &config);
 
     if (net_boxes){
         detected = true;
@@ -297,16 +278,43 @@ static esp_err_t capture_handler(httpd_req_t *req){
         free(net_boxes);
     }
 
-    jpg_chunking_t jchunk = {req, 0};
-    s = fmt2jpg_cb(out_buf, out_len, out_width, out_height, PIXFORMAT_RGB888, 90, jpg_encode_stream, &jchunk);
-    dl_matrix3du_free(image_matrix);
-    if(!s){
+    frame = jpeg_frame_encode(image_matrix->item, image_matrix->w * image_matrix->h * 3, image_matrix->w, image_matrix->h, PIXFORMAT_RGB888, 90, fr_start);
+    matrix_cache_return(image_matrix);
+    if(!frame){
         Serial.println("JPEG compression failed");
-        return ESP_FAIL;
+        return NULL;
     }
 
     int64_t fr_end = esp_timer_get_time();
-    Serial.printf("FACE: %uB %ums %s%d\n", (uint32_t)(jchunk.len), (uint32_t)((fr_end - fr_start)/1000), detected?"DETECTED ":"", face_id);
+    Serial.printf("FACE: %uB %ums %s%d\n", (uint32_t)(frame->len), (uint32_t)((fr_end - fr_start)/1000), detected?"DETECTED ":"", face_id);
+    return frame;
+}
+
+static esp_err_t capture_handler(httpd_req_t *req){
+    char etag[16];
+    char if_none_match[16] = {0,};
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    // a poller that has the frame to serve is answered before anything is captured
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+        capture_cache_not_modified(if_none_match)) {
+        httpd_resp_set_hdr(req, "ETag", if_none_match);
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    jpeg_frame_t * frame = capture_cache_get(capture_produce, NULL);
+    if (!frame) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    snprintf(etag, sizeof(etag), "\"%u\"", frame->id);
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
+    esp_err_t res = httpd_resp_send(req, (const char *)frame->buf + STREAM_PART_HEADROOM, frame->len);
+    jpeg_frame_release(frame);
     return res;
 }
 
@@ -326,6 +334,7 @@ struct Map{
 
     }
 
+    // x is 1-based, y is the row from 0
     RGB * getMap(uint32_t x, uint32_t y){
         return (RGB*)&(map[((y * W) + (x - 1)) * 3]);
     }
@@ -418,13 +427,14 @@ template<typename _Tp>
 	  std::__throw_bad_alloc();
     //   Serial.printf("ps_malloc \n");
 
-	return static_cast<_Tp*>(ps_malloc(__n * sizeof(_Tp)));
+	// only the tracked dots use this, a small table read every frame
+	return static_cast<_Tp*>(mem_budget_malloc(MEM_STAGE_DETECT, __n * sizeof(_Tp), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
       }
 
       // __p is not permitted to be a null pointer.
       void
       deallocate(pointer __p, size_type)
-      { free(__p);
+      { mem_budget_free(__p);
         // ::operator delete(__p);
          }
 
@@ -470,144 +480,85 @@ template<typename _Tp>
 
 
 
-#define SEARCH_RADIUS 3
 
-bool ifPurple(int R, int G, int B){
-    // if (R > 0xA5 && R > G && R - G < 40 && R - B < 5 && R - B > -5)
-    //     return true;
-    if (R > 0x95 && G > 0x95 && B > 0x95)
-        return true;
-    return false;
-}
+// set per frame by irdetector(), the model lags a frame size change
+static bool background_usable = false;
 
-static void detect_around(Map &map, Bitmap &detected_mask, Dot &dot){
-    // Serial.printf("init\n");
-    Bitmap need_detect_mask(map.W, map.H, map.L);
-    // Serial.printf("init 2\n");
-    //Bitmap alredy_detect_mask(map.W, map.H, map.L);
-    // Serial.printf("init 2\n");
+// the class of a pixel the background model does not explain, 0 for none;
+// Map x is 1-based
+static inline uint8_t foreground_class(uint32_t x, uint32_t y, int R, int G, int B){
+    const uint8_t cls = classify(R, G, B);
+    const uint8_t *bg = background_usable ? background_row(y) : NULL;
+    if (cls && background_foreground(bg, x - 1, background_level(R, G, B), background_margin()))
+        return cls;
+    return 0;
+}
 
-    uint32_t lastX, lastY;
+// Gaps of up to 2r + 1 pixels between hits are bridged by dilating them with
+// radius r, so SEARCH_RADIUS / 2 keeps the SEARCH_RADIUS rule. Hits that do not
+// survive an opening with morph_open_radius are dropped as specks, 0 keeps
+// them all.
+static uint8_t morph_dilate_radius = SEARCH_RADIUS / 2;
+static uint8_t morph_open_radius = 0;
+
+// The hits of one class outside the dots found so far, and the same hits
+// dilated into bridged. Built once per class the first time a frame finds a
+// new dot of that class.
+struct ClassMasks{
+    Bitmap hits;
+    Bitmap bridged;
+    Bitmap scratch;
+    uint8_t cls; //0 until built
+
+    ClassMasks(size_t w, size_t h) : hits(w, h), bridged(w, h), scratch(w, h), cls(0) {}
+};
 
-    Vector2u first_detect;
-    
-    first_detect.x = dot.x;
-    first_detect.y = dot.y;
-    lastX = dot.x;
-    lastY = dot.y;
-    
-    std::list<Vector2u, new_allocator<Vector2u>> need_detect_vector(1, first_detect, new_allocator<Vector2u>());
-
-    // Serial.printf("init 2\n");
-
-    while (need_detect_vector.size() > 0){
-        // Serial.printf("init 3\n");
-        auto elem = need_detect_vector.begin();
-        const uint32_t x = elem->x;
-        const uint32_t y = elem->y;
-        const int R = map.getMap(x, y)->R;
-        const int G = map.getMap(x, y)->G;
-        const int B = map.getMap(x, y)->B;
-         
-        
-        if (ifPurple(R, G, B) && !detected_mask.getCell(x, y)){
-            //log_d("x = %u, y = %u, size = %u", x, y, need_detect_vector.size());
-           // alredy_detect_mask.setCell(x, y, true);
-			detected_mask.setCell(x,y, true);
-			if (dot.x > x)
-            	dot.x = x;
-        	if (dot.y > y)
-            	dot.y = y;
-        	if (lastX < x)
-            	lastX = x;
-        	if (lastY < y)
-            	lastY = y;
-			const int beginY = ((int)y - SEARCH_RADIUS < 1 ? 1 : y - SEARCH_RADIUS);
-			const int endY = (y + SEARCH_RADIUS > map.H ? map.H : y + SEARCH_RADIUS);
-			const int beginX = ((int)x - SEARCH_RADIUS < 1 ? 1 : x - SEARCH_RADIUS);
-			const int endX = (x + SEARCH_RADIUS > map.W ? map.W : x + SEARCH_RADIUS);
-            for(uint32_t yy = beginY; yy <= endY; ++yy){
-                for(uint32_t xx = beginX; xx <= endX; ++xx){
-                    if (!detected_mask.getCell(xx, yy)/* && !alredy_detect_mask.getCell(xx, yy)*/ && !need_detect_mask.getCell(xx, yy)){
-                        Vector2u detect_elem = {xx, yy};
-                        need_detect_vector.push_back(detect_elem);
-                        need_detect_mask.setCell(xx, yy, true);
-                    }
-                }    
+static void IRAM_ATTR build_class_masks(Map &map, Bitmap &detected_mask, ClassMasks &masks, uint8_t cls){
+    const uint32_t S = masks.hits.S;
+    for (uint32_t y = 0; y < map.H; ++y){
+        uint32_t *row = masks.hits.row(y);
+        const uint32_t *done = detected_mask.row(y);
+        for (uint32_t i = 0; i < S; ++i){
+            const uint32_t n = map.W - i * 32 < 32 ? map.W - i * 32 : 32;
+            const RGB *p = map.getMap(i * 32 + 1, y);
+            uint32_t word = 0;
+            for (uint32_t b = 0; b < n; ++b, ++p){
+                if (foreground_class(i * 32 + b + 1, y, p->R, p->G, p->B) == cls)
+                    word |= 1u << b;
             }
-
-            // if (x > 1 && !detected_mask.getCell(x - 1, y) && !alredy_detect_mask.getCell(x - 1, y)){
-            //     Vector2u detect_elem = {x - 1, y};
-            //     need_detect_vector.push_back(detect_elem);
-            //     need_detect_mask.setCell(x - 1, y, true);
-            // }
-            // if (x > 1 && y > 1 && !detected_mask.getCell(x - 1, y - 1) && !alredy_detect_mask.getCell(x - 1, y - 1)){
-            //     Vector2u detect_elem = {x - 1, y - 1};
-            //     need_detect_vector.push_back(detect_elem);
-            //     need_detect_mask.setCell(x - 1, y - 1, true);
-            // }
-            // if (y > 1 && !detected_mask.getCell(x, y - 1) && !alredy_detect_mask.getCell(x, y - 1)){
-            //     Vector2u detect_elem = {x, y - 1};
-            //     need_detect_vector.push_back(detect_elem);
-            //     need_detect_mask.setCell(x, y - 1, true);
-            // }
-            // if (x < map.W && y > 1 && !detected_mask.getCell(x + 1, y - 1) && !alredy_detect_mask.getCell(x + 1, y - 1)){
-            //     Vector2u detect_elem = {x + 1, y - 1};
-            //     need_detect_vector.push_back(detect_elem);
-            //     need_detect_mask.setCell(x + 1, y - 1, true);
-            // }
-            // if (x < map.W && !detected_mask.getCell(x + 1, y) && !alredy_detect_mask.getCell(x + 1, y)){
-            //     Vector2u detect_elem = {x + 1, y};
-            //     need_detect_vector.push_back(detect_elem);
-            //     need_detect_mask.setCell(x + 1, y, true);
-            // }
-            // if (x < map.W && y < map.H && !detected_mask.getCell(x + 1, y + 1) && !alredy_detect_mask.getCell(x + 1, y + 1)){
-            //     Vector2u detect_elem = {x + 1, y + 1};
-            //     need_detect_vector.push_back(detect_elem);
-            //     need_detect_mask.setCell(x + 1, y + 1, true);
-            // }
-            // if (y < map.H && !detected_mask.getCell(x, y + 1) && !alredy_detect_mask.getCell(x, y + 1)){
-            //     Vector2u detect_elem = {x, y + 1};
-            //     need_detect_vector.push_back(detect_elem);
-            //     need_detect_mask.setCell(x, y + 1, true);
-            // }
-            // if (x > 1 && y < map.H && !detected_mask.getCell(x - 1, y + 1) && !alredy_detect_mask.getCell(x - 1, y + 1)){
-            //     Vector2u detect_elem = {x - 1, y + 1};
-            //     need_detect_vector.push_back(detect_elem);
-            //     need_detect_mask.setCell(x - 1, y + 1, true);
-            // }
+            row[i] = word & ~done[i];
         }
-        need_detect_vector.erase(elem);
     }
+    uint32_t *hits = masks.hits.row(0);
+    morph_open(hits, masks.scratch.row(0), map.W, map.H, S, morph_open_radius);
+    memcpy(masks.bridged.row(0), hits, map.H * S * sizeof(uint32_t));
+    morph_dilate(masks.bridged.row(0), masks.scratch.row(0), map.W, map.H, S, morph_dilate_radius);
+    masks.cls = cls;
+}
 
-    // uint32_t xx = 1;
-    // uint32_t yy = 1;
-
-    // for (uint32_t y = 1; y <= map.H; ++y){
-    //     for (uint32_t x = 1; x <= map.W; ++x){
-    //         if (alredy_detect_mask.getCell(x, y)){
-    //             if (dot.x > x)
-    //                 dot.x = x;
-    //             if (dot.y > y)
-    //                 dot.y = y;
-    //             if (xx < x)
-    //                 xx = x;
-    //             if (yy < y)
-    //                 yy = y; 
-    //         }
-    //     }
-    // }
-    dot.w = lastX - dot.x;
-    dot.h = lastY - dot.y;
-    
+// Fills dot with the 8-connected component of masks.bridged through its seed
+// (see morph_component()); the box and detected_mask take only the hits under
+// the component. False when the seed was opened away.
+static bool IRAM_ATTR detect_around(Bitmap &detected_mask, ClassMasks &masks, DetectQueue &need_detect_vector, Dot &dot){
+    morph_box_t box;
+    if (!morph_component(masks.bridged.row(0), masks.hits.row(0), detected_mask.row(0), masks.bridged.W, masks.bridged.H,
+                         masks.bridged.S, dot.x - 1, dot.y, need_detect_vector, &box))
+        return false;
+    dot.x = box.x0 + 1;
+    dot.y = box.y0;
+    dot.w = box.x1 - box.x0;
+    dot.h = box.y1 - box.y0;
+    return true;
 }
 
 int limiter = 0;
 	
 
-static void dotsDetector(Map map, std::vector<Dot, new_allocator<Dot>> &dots){
+static void IRAM_ATTR dotsDetector(Map map, std::vector<Dot, new_allocator<Dot>> &dots){
 
-    Bitmap bitmap(map.W, map.H, map.L);
+    Bitmap bitmap(map.W, map.H);
+    // a run is queued at most once per run it touches, which bounds the spill area
+    DetectQueue need_detect_vector(map.W * map.H + DOTS_MAX);
     // bool *bitmap = new bool[map.L];
     // Serial.printf("in 1\n");
     for (auto dot : dots){
@@ -626,17 +577,30 @@ static void dotsDetector(Map map, std::vector<Dot, new_allocator<Dot>> &dots){
     // }
     int h = map.H / 15;
 
+    // a new blob can only show up where the scene changed since the band was
+    // last scanned; a band cut short by DOTS_MAX does not count as scanned
+    static uint32_t band_scanned[15] = {0};
+    static uint32_t band_generation[15] = {0};
+    if (band_generation[limiter] == detector_generation &&
+        !motion_gate_changed_since(band_scanned[limiter], 0, h * limiter, map.W, h)){
+        if (++limiter == 15)
+            limiter = 0;
+        return;
+    }
+    const uint32_t frame = motion_gate_frame();
+    ClassMasks masks(map.W, map.H);
     
     // Serial.printf("in 2\n");
-    for (int y = h * limiter + 1; y <= h * (limiter + 1); ++y){
+    for (int y = h * limiter; y < h * (limiter + 1); ++y){
         //Serial.printf("in 3\n");
         for (int x = 1; x <= map.W; ++x){
            // Serial.printf("in 4\n");
            const int R = map.getMap(x, y)->R;
            const int G = map.getMap(x, y)->G;
            const int B = map.getMap(x, y)->B;
-            if (ifPurple(R, G, B) &&   bitmap.getCell(x, y) == false){
-                if (dots.size() > 10)
+            const uint8_t cls = foreground_class(x, y, R, G, B);
+            if (cls &&   bitmap.getCell(x, y) == false){
+                if (dots.size() >= DOTS_MAX)
                     return;
                 //Serial.printf("in 5\n");
                 Dot dot;
@@ -644,7 +608,12 @@ static void dotsDetector(Map map, std::vector<Dot, new_allocator<Dot>> &dots){
                 dot.y = y;
                 dot.w = 0;
                 dot.h = 0;
-                detect_around(map, bitmap, dot);
+                dot.id = 0;
+                dot.cls = cls;
+                if (masks.cls != cls)
+                    build_class_masks(map, bitmap, masks, cls);
+                if (!detect_around(bitmap, masks, need_detect_vector, dot))
+                    continue;
                 // bool Break = false;
                 // for (int ii = y;ii < map.H; ii++){
                 //     for (int jj = x; jj >= 0; --jj){
@@ -690,6 +659,8 @@ static void dotsDetector(Map map, std::vector<Dot, new_allocator<Dot>> &dots){
             
         }
     }
+    band_scanned[limiter] = frame;
+    band_generation[limiter] = detector_generation;
     ++limiter;
     if (limiter == 15)
         limiter = 0;
@@ -832,9 +803,9 @@ static void draw_crosses(dl_matrix3du_t *image_matrix, std::vector<Dot, new_allo
 
 #define PIXEL_SHIFT 10
 
-void dotsTrack(Map &map){
+void IRAM_ATTR dotsTrack(Map &map){
    
-    Bitmap already_detected(map.W, map.H, map.L);
+    Bitmap already_detected(map.W, map.H);
 
     for (auto dot = dots.begin(); dot != dots.end(); ){ 
         // Serial.printf("dot x = %u, y = %u, w = %u, h = %u", dot->x,  dot->y,  dot->w, dot->h);     
@@ -846,10 +817,10 @@ void dotsTrack(Map &map){
     //    Serial.printf("mod dot x = %u, y = %u, w = %u, h = %u\n", x,  y,  w, h);
         if (x < 1)
             x = 1;
-        if (y < 1)
-            y = 1;
-        if (h > map.H)
-            h = map.H;
+        if (y < 0)
+            y = 0;
+        if (h >= (int)map.H)
+            h = map.H - 1;
         if (w > map.W)
             w = map.W;
         // Serial.printf("mod2 dot x = %i, y = %i, w = %i, h = %i\n", x,  y,  w, h);
@@ -865,7 +836,7 @@ void dotsTrack(Map &map){
                 const int G = map.getMap(xx, yy)->G;
                 const int B = map.getMap(xx, yy)->B;
                 // RGB *rgb = map.getMap(x, y);
-                if (ifPurple(R, G, B) && !already_detected.getCell(xx, yy)){
+                if (foreground_class(xx, yy, R, G, B) == dot->cls && !already_detected.getCell(xx, yy)){
                 //    Serial.printf("in x = %i, y = %i", x, y);
                     if (dot->x > xx)
             	        dot->x = xx;
@@ -885,8 +856,6 @@ void dotsTrack(Map &map){
         dot->h = lastY - dot->y;
         if (detected){
         //    Serial.printf("dot x = %u, y = %u, w = %u, h = %u\n", dot->x,  dot->y,  dot->w, dot->h) ;
-            DrawLine(map, dot->x, dot->y, dot->x + dot->w, dot->y + dot->h);
-            DrawLine(map, dot->x, dot->y + dot->h, dot->x + dot->w, dot->y);
             for (int yy = dot->y; yy <= dot->y + dot->h; ++yy){
                 for (int xx = dot->x; xx <= dot->x + dot->w; ++xx){
                     already_detected.setCell(xx, yy, true);
@@ -902,7 +871,66 @@ void dotsTrack(Map &map){
 
 
 
+// Dots the legacy tracker followed keep their id. Every other dot takes the id
+// of the nearest unclaimed dot of its class in the previous frame within
+// TRACK_GATE, or a new one. The tiled detector finds all dots afresh each frame, so for it this
+// is the only association.
+static Dot prev_dots[DOTS_MAX];
+static size_t prev_count = 0;
+static uint32_t next_track_id = 1;
+
+static void assign_track_ids(std::vector<Dot, new_allocator<Dot>> &dots){
+    bool claimed[DOTS_MAX] = {false};
+    for (auto &dot : dots){
+        for (size_t j = 0; dot.id && j < prev_count; ++j){
+            if (prev_dots[j].id == dot.id)
+                claimed[j] = true;
+        }
+    }
+    for (auto &dot : dots){
+        if (dot.id)
+            continue;
+        int best = -1;
+        int32_t best_d = TRACK_GATE * TRACK_GATE;
+        for (size_t j = 0; j < prev_count; ++j){
+            if (claimed[j] || prev_dots[j].cls != dot.cls)
+                continue;
+            const int32_t dx = (int32_t)(dot.x + dot.w / 2) - (int32_t)(prev_dots[j].x + prev_dots[j].w / 2);
+            const int32_t dy = (int32_t)(dot.y + dot.h / 2) - (int32_t)(prev_dots[j].y + prev_dots[j].h / 2);
+            if (dx * dx + dy * dy <= best_d){
+                best_d = dx * dx + dy * dy;
+                best = j;
+            }
+        }
+        if (best >= 0){
+            dot.id = prev_dots[best].id;
+            claimed[best] = true;
+        } else {
+            dot.id = next_track_id++;
+            if (!next_track_id)
+                next_track_id = 1;
+        }
+    }
+    prev_count = 0;
+    for (auto &dot : dots){
+        if (prev_count < DOTS_MAX)
+            prev_dots[prev_count++] = dot;
+    }
+}
+
+// irdetector() runs in loop(). The lock keeps the frame arenas and the
+// detector statistics to one user at a time, since /bench's blob search runs
+// the tiled detector from httpd. It also makes the detector settings in
+// control_setters change between frames rather than during one.
+static SemaphoreHandle_t detector_lock = xSemaphoreCreateMutex();
+static bool tiled_last = false; //the dots came from the tiled detector
+
 void irdetector(camera_fb_t * fb, std::vector<Dot> &detectedDots){
+    xSemaphoreTake(detector_lock, portMAX_DELAY);
+    classifier_begin_frame();
+    if (dots.capacity() < DOTS_MAX){
+        dots.reserve(DOTS_MAX);
+    }
     const size_t lenth = fb->len;
     const size_t width = fb->width;
     const size_t height = fb->height;
@@ -912,44 +940,44 @@ void irdetector(camera_fb_t * fb, std::vector<Dot> &detectedDots){
     
     Map map(width, height, lenth);
     map.map = fb->buf;
-    dotsTrack(map);
-    // Serial.printf("with = %u, height = %u, len = %u\n", fb->width, fb->height, fb->len);
-    // Serial.printf("dots 1");
-    dotsDetector(map, dots);
+    background_usable = background_fits(width, height);
+    // the random-access detector only works on small RGB888 frames
+    const bool tiled = tiled_mode == TILED_ON || fb->format != PIXFORMAT_RGB888 ||
+        (tiled_mode == TILED_AUTO && width * height > 160 * 120);
+    // the tiled detector finds every dot afresh, an unchanged frame keeps the
+    // last result
+    static uint32_t tiled_seen = 0;
+    static uint32_t tiled_generation = 0;
+    if (tiled && (!tiled_last || tiled_generation != detector_generation ||
+                  motion_gate_frame_changed_since(tiled_seen))){
+        tiled_seen = motion_gate_frame();
+        tiled_generation = detector_generation;
+        Dot found[DOTS_MAX];
+        int count = tiled_detect(fb, found, DOTS_MAX, tiled_coarse, true);
+        dots.clear();
+        for (int i = 0; i < count; ++i){
+            dots.push_back(found[i]);
+        }
+    } else if (!tiled) {
+        dotsTrack(map);
+        // Serial.printf("with = %u, height = %u, len = %u\n", fb->width, fb->height, fb->len);
+        // Serial.printf("dots 1");
+        dotsDetector(map, dots);
+    }
+    tiled_last = tiled;
+    assign_track_ids(dots);
     // Serial.printf("dots 2");
     // image_matrix = dl_matrix3du_alloc(1, fb->width, fb->height, 3);
     // fmt2rgb888(fb->buf, fb->len, fb->format, image_matrix->item);
     // Serial.printf("dots 3");
 	// Serial.printf("heap size = %u, psram size = %u", ESP.getFreeHeap(), ESP.getFreePsram());
-    int x, y, w, h;
-    for (auto dot : dots)
-    {
-        
-        x = dot.x;
-        y = dot.y;
-        w = dot.w;
-        h = dot.h;
-        if (x - 1 + w / 2 - 5 < 0)
-            x = 1 + 5;
-        if (y - 1 + h / 2 - 5 < 0)
-            y = 1 + 5;
-        if (x - 1 + w / 2 + 5 >= fb->width)
-            x = fb->width - w / 2 - 1 - 5;
-        if (y - 1 + h / 2 + 5 >= fb->height)
-            y = fb->height - h / 2 - 1 - 5;
-        // Serial.printf("x = %i\n y = %i\n w = %i\n h = %i\n", dot.x, dot.y, dot.w, dot.h);
-        // if (dot.x < 10 || dot.y < 10 || dot.y > fb.height - 10 || dot.x > fb.width - 10)
-        //     continue;
-        DrawLine(map, x - 1 + w / 2 - 5, y - 1 + h / 2, x - 1 + w / 2 + 5, y - 1 + h / 2);
-        DrawLine(map, x - 1 + w / 2, y - 1 + h / 2 - 5, x - 1 + w / 2, y - 1 + h / 2 + 5);
-        // fb_gfx_drawFastHLine(&fb, x - 1 + w / 2 - 5, y - 1 + h / 2, 10, color);
-        // // log_d("H line %i", ((((dot.y + dot.h / 2) - 5) > 1) ? ((dot.y + dot.h / 2) - 5) : 1));
-        // fb_gfx_drawFastVLine(&fb, x - 1 + w / 2, y - 1 + h / 2 - 5, 10, color);
-        // log_d("V line");
-        // Serial.printf("cross in 4");
+    for (auto dot : dots){
         detectedDots.push_back(dot);
     }
     
+    frame_arena_dram.reset();
+    frame_arena_psram.reset();
+    xSemaphoreGive(detector_lock);
     // draw_crosses(image_matrix, dots);
     // fmt2rgb888(image_matrix->item, fb->len, fb->format, fb->buf);
     // dl_matrix3du_free(image_matrix);
@@ -971,142 +999,213 @@ void irdetector(camera_fb_t * fb, std::vector<Dot> &detectedDots){
 //     }
 }
 
-// #include "esp_heap_caps.h"
+// Marks the dots irdetector() found in fb. loop() calls it after
+// background_update(), so the model never learns the marks as scene.
+void irdetector_draw(camera_fb_t * fb, const std::vector<Dot> &detectedDots){
+    if (fb->format != PIXFORMAT_RGB888)
+        return;
+    Map map(fb->width, fb->height, fb->len);
+    map.map = fb->buf;
+    int x, y, w, h;
+    for (auto dot : detectedDots)
+    {
+        // the legacy detector also crosses out the box it found
+        if (!tiled_last){
+            DrawLine(map, dot.x, dot.y, dot.x + dot.w, dot.y + dot.h);
+            DrawLine(map, dot.x, dot.y + dot.h, dot.x + dot.w, dot.y);
+        }
+        x = dot.x;
+        y = dot.y;
+        w = dot.w;
+        h = dot.h;
+        if (x - 1 + w / 2 - 5 < 0)
+            x = 1 + 5;
+        if (y - 1 + h / 2 - 5 < 0)
+            y = 1 + 5;
+        if (x - 1 + w / 2 + 5 >= fb->width)
+            x = fb->width - w / 2 - 1 - 5;
+        if (y - 1 + h / 2 + 5 >= fb->height)
+            y = fb->height - h / 2 - 1 - 5;
+        DrawLine(map, x - 1 + w / 2 - 5, y - 1 + h / 2, x - 1 + w / 2 + 5, y - 1 + h / 2);
+        DrawLine(map, x - 1 + w / 2, y - 1 + h / 2 - 5, x - 1 + w / 2, y - 1 + h / 2 + 5);
+    }
+}
+
+// Frames reach the stream through stream_offer_frame(): loop() captures and
+// runs the detector, then offers the annotated frame to the encoder task. The
+// encoder converts it to JPEG once and publishes it to every /stream client.
+static QueueHandle_t stream_frames = NULL;
+static volatile bool stream_encoder_busy = false;
 
-static esp_err_t stream_handler(httpd_req_t *req){
-	// heap_caps_check_integrity_all(1);
+static uint32_t stream_seen = 0; //motion frame of the last frame offered
+static int64_t stream_last_offer = 0;
+
+bool stream_offer_frame(camera_fb_t *fb){
+    if (!stream_frames || !stream_broadcast_subscribers() || stream_encoder_busy){
+        return false;
+    }
+    // clients keep showing the last frame while nothing moves
+    const int64_t now = esp_timer_get_time();
+    if (!motion_gate_frame_changed_since(stream_seen) && now - stream_last_offer < MOTION_REFRESH_MS * 1000LL){
+        return false;
+    }
+    if (!stream_rate_offer()){
+        return false;
+    }
+    // the encoder owns fb until it returns it; with two frame buffers loop()
+    // keeps capturing into the other one meanwhile
+    stream_encoder_busy = true;
+    if (xQueueSend(stream_frames, &fb, 0) != pdTRUE){
+        stream_encoder_busy = false;
+        return false;
+    }
+    stream_seen = motion_gate_frame();
+    stream_last_offer = now;
+    return true;
+}
+
+static void stream_encode_task(void *arg){
     camera_fb_t * fb = NULL;
     esp_err_t res = ESP_OK;
     size_t _jpg_buf_len = 0;
-    uint8_t * _jpg_buf = NULL;
-    char * part_buf[64];
+    jpeg_frame_t *frame = NULL;
     dl_matrix3du_t *image_matrix = NULL;
     bool detected = false;
+    bool roi_applied = false;
     int face_id = 0;
+    face_result_t label; //latest result that matched a track
+    uint32_t face_seen = 0; //motion frame of the last face detection
     int64_t fr_start = 0;
     int64_t fr_ready = 0;
     int64_t fr_face = 0;
     int64_t fr_recognize = 0;
     int64_t fr_encode = 0;
+    int64_t last_frame = 0;
+    mem_frame_t mem_frame;
 
-    static int64_t last_frame = 0;
-    if(!last_frame) {
-        last_frame = esp_timer_get_time();
-    }
-
-    res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
-    if(res != ESP_OK){
-        return res;
-    }
-
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    std::vector<Dot> vec;
+    memset(&label, 0, sizeof(label));
     while(true){
+        xQueueReceive(stream_frames, &fb, portMAX_DELAY);
+        mem_budget_frame_begin(&mem_frame);
+        res = ESP_OK;
         detected = false;
+        roi_applied = false;
         face_id = 0;
-        fb = esp_camera_fb_get();
-        if (!fb) {
-            Serial.println("Camera capture failed");
-            res = ESP_FAIL;
-        } else {
-            irdetector(fb, vec);
-            fr_start = esp_timer_get_time();
-            fr_ready = fr_start;
-            fr_face = fr_start;
-            fr_encode = fr_start;
-            fr_recognize = fr_start;
-            log_d("detect0");
-            if(!detection_enabled || fb->width > 400){
-                log_d("detect1");
-                if(fb->format != PIXFORMAT_JPEG){
-                    bool jpeg_converted = frame2jpg(fb, 20, &_jpg_buf, &_jpg_buf_len);
-                   // bool jpeg_converted = frame2bmp(fb, &_jpg_buf, &_jpg_buf_len);
-                    esp_camera_fb_return(fb);
-                    fb = NULL;
-                    log_d("detect2");
-                    if(!jpeg_converted){
-                        Serial.println("JPEG compression failed");
-                        res = ESP_FAIL;
-                    }
-                } else {
-                    _jpg_buf_len = fb->len;
-                    _jpg_buf = fb->buf;
+        frame = NULL;
+        _jpg_buf_len = 0;
+        fr_start = esp_timer_get_time();
+        fr_ready = fr_start;
+        fr_face = fr_start;
+        fr_encode = fr_start;
+        fr_recognize = fr_start;
+        if(!last_frame) {
+            last_frame = fr_start;
+        }
+        if(!detection_enabled || fb->width > 400){
+            if(fb->format != PIXFORMAT_JPEG){
+                roi_applied = stream_roi_encode(fb, stream_rate_quality(), fr_start, &frame);
+                if(!roi_applied){
+                    frame = jpeg_frame_encode(fb->buf, fb->len, fb->width, fb->height, fb->format, stream_rate_quality(), fr_start);
+                }
+                if(!frame){
+                    Serial.println("JPEG compression failed");
+                    res = ESP_FAIL;
                 }
+            }
+        } else {
+            image_matrix = matrix_cache_borrow(fb->width, fb->height, 3);
+            if (!image_matrix) {
+                Serial.println("face matrix allocation failed");
+                res = ESP_FAIL;
             } else {
-
-                image_matrix = dl_matrix3du_alloc(1, fb->width, fb->height, 3);
-
-                if (!image_matrix) {
-                    Serial.println("dl_matrix3du_alloc failed");
+                if(!fmt2rgb888(fb->buf, fb->len, fb->format, image_matrix->item)){
+                    Serial.println("fmt2rgb888 failed");
                     res = ESP_FAIL;
                 } else {
-                    if(!fmt2rgb888(fb->buf, fb->len, fb->format, image_matrix->item)){
-                        Serial.println("fmt2rgb888 failed");
-                        res = ESP_FAIL;
-                    } else {
-                        fr_ready = esp_timer_get_time();
-                        box_array_t *net_boxes = NULL;
-                        if(detection_enabled){
-                            net_boxes = face_detect(image_matrix, &mtmn_config);
+                    fr_ready = esp_timer_get_time();
+                    box_array_t *net_boxes = NULL;
+                    box_array_t *boxes = NULL;
+                    if(detection_enabled){
+                        // full detection every few frames, tracked boxes in between
+                        // a still scene keeps its faces, detect again once it changes
+                        const bool due = face_tracker_due(fr_start);
+                        if(due && !motion_gate_frame_changed_since(face_seen)){
+                            face_tracker_hold(fr_start);
+                        } else if(due){
+                            face_seen = motion_gate_frame() - 1;
+                            mtmn_config_t config;
+                            mtmn_tuner_get_config(&config);
+                            net_boxes = face_detect(image_matrix, &config);
+                            const uint32_t detect_us = esp_timer_get_time() - fr_ready;
+                            mtmn_tuner_measured(fb->width, fb->height, detect_us);
+                            face_tracker_detected(net_boxes, fr_start, detect_us);
                         }
-                        fr_face = esp_timer_get_time();
-                        fr_recognize = fr_face;
-                        if (net_boxes || fb->format != PIXFORMAT_JPEG){
-                            if(net_boxes){
-                                detected = true;
-                                if(recognition_enabled){
-                                    face_id = run_face_recognition(image_matrix, net_boxes);
+                        boxes = net_boxes ? net_boxes : face_tracker_boxes(fr_start);
+                        // identities arrive from the face worker a frame or two later
+                        face_result_t result;
+                        if(face_worker_result(&result) && face_tracker_identify(result.track, result.face_id)){
+                            label = result;
+                        }
+                    }
+                    fr_face = esp_timer_get_time();
+                    fr_recognize = fr_face;
+                    if (boxes || fb->format != PIXFORMAT_JPEG){
+                        if(boxes){
+                            detected = true;
+                            if(recognition_enabled){
+                                dl_matrix3du_t *aligned_face = net_boxes ? face_worker_buffer() : NULL;
+                                if(aligned_face && align_face(net_boxes, image_matrix, aligned_face) == ESP_OK){
+                                    face_worker_post(face_tracker_id(0), fr_start);
+                                }
+                                face_id = face_tracker_face_id(0);
+                                if(label.label[0] && face_tracker_index(label.track) >= 0){
+                                    rgb_print(image_matrix, label.color, label.label);
                                 }
-                                fr_recognize = esp_timer_get_time();
-                                draw_face_boxes(image_matrix, net_boxes, face_id);
-                                free(net_boxes->score);
-                                free(net_boxes->box);
-                                free(net_boxes->landmark);
-                                free(net_boxes);
-                            }
-                            if(!fmt2jpg(image_matrix->item, fb->width*fb->height*3, fb->width, fb->height, PIXFORMAT_RGB888, 90, &_jpg_buf, &_jpg_buf_len)){
-                                Serial.println("fmt2jpg failed");
-                                res = ESP_FAIL;
                             }
-                            esp_camera_fb_return(fb);
-                            fb = NULL;
-                        } else {
-                            _jpg_buf = fb->buf;
-                            _jpg_buf_len = fb->len;
+                            fr_recognize = esp_timer_get_time();
+                            draw_face_boxes(image_matrix, boxes, face_id);
+                        }
+                        if(net_boxes){
+                            free(net_boxes->score);
+                            free(net_boxes->box);
+                            free(net_boxes->landmark);
+                            free(net_boxes);
+                        }
+                        frame = jpeg_frame_encode(image_matrix->item, fb->width*fb->height*3, fb->width, fb->height, PIXFORMAT_RGB888, stream_rate_quality(), fr_start);
+                        if(!frame){
+                            Serial.println("fmt2jpg failed");
+                            res = ESP_FAIL;
                         }
-                        fr_encode = esp_timer_get_time();
                     }
-                    dl_matrix3du_free(image_matrix);
+                    fr_encode = esp_timer_get_time();
                 }
+                matrix_cache_return(image_matrix);
             }
         }
-        log_d("detect3");
-        if(res == ESP_OK){
-            size_t hlen = snprintf((char *)part_buf, 64, _STREAM_PART, _jpg_buf_len);
-            res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
-        }
-        log_d("detect4");
-        if(res == ESP_OK){
-            res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
-        }
-        log_d("detect5");
-        if(res == ESP_OK){
-            res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
-        }
-        log_d("detect6");
-        if(fb){
-            esp_camera_fb_return(fb);
-            fb = NULL;
-            _jpg_buf = NULL;
-        } else if(_jpg_buf){
-            free(_jpg_buf);
-            _jpg_buf = NULL;
+        if(res == ESP_OK && !frame){
+            // the sensor already delivered JPEG, publish a copy so the frame
+            // buffer can go back to the driver right away
+            frame = jpeg_frame_copy(fb->buf, fb->len, fr_start);
+            if(!frame){
+                res = ESP_FAIL;
+            }
         }
-        log_d("detect7");
-        if(res != ESP_OK){
-            break;
+        esp_camera_fb_return(fb);
+        fb = NULL;
+        stream_encoder_busy = false;
+
+        if(frame){
+            _jpg_buf_len = frame->len;
+            stream_rate_encoded(esp_timer_get_time() - fr_start);
+            if(!roi_applied){
+                capture_cache_offer(frame);
+            }
+            stream_broadcast_publish(frame);
+            jpeg_frame_release(frame);
+            frame = NULL;
         }
-        log_d("detect8");
+        mem_budget_frame_end(&mem_frame, "stream");
+
         int64_t fr_end = esp_timer_get_time();
 
         int64_t ready_time = (fr_ready - fr_start)/1000;
@@ -1116,7 +1215,6 @@ static esp_err_t stream_handler(httpd_req_t *req){
         int64_t process_time = (fr_encode - fr_start)/1000;
         
         int64_t frame_time = fr_end - last_frame;
-        log_d("detect9");
         last_frame = fr_end;
         frame_time /= 1000;
         uint32_t avg_frame_time = ra_filter_run(&ra_filter, frame_time);
@@ -1128,9 +1226,228 @@ static esp_err_t stream_handler(httpd_req_t *req){
             (detected)?"DETECTED ":"", face_id
         );
     }
+}
 
-    last_frame = 0;
-    return res;
+static esp_err_t stream_handler(httpd_req_t *req){
+    return stream_broadcast_subscribe(req);
+}
+
+static esp_err_t dots_handler(httpd_req_t *req){
+    return dots_stream_subscribe(req);
+}
+
+// /control and the WebSocket control channel share this table. It is kept
+// sorted by name so control_set() can binary-search it; control_table_check()
+// reports an entry out of order at startup.
+typedef struct {
+    const char *name;
+    int (*set)(sensor_t *s, int val);
+    bool detector; //applied between detector frames, see detector_generation
+} control_setter_t;
+
+static const control_setter_t control_setters[] = {
+    {"ae_level", [](sensor_t *s, int val){ return s->set_ae_level(s, val); }},
+    {"aec", [](sensor_t *s, int val){ return s->set_exposure_ctrl(s, val); }},
+    {"aec2", [](sensor_t *s, int val){ return s->set_aec2(s, val); }},
+    {"aec_value", [](sensor_t *s, int val){ return s->set_aec_value(s, val); }},
+    {"agc", [](sensor_t *s, int val){ return s->set_gain_ctrl(s, val); }},
+    {"agc_gain", [](sensor_t *s, int val){ return s->set_agc_gain(s, val); }},
+    {"awb", [](sensor_t *s, int val){ return s->set_whitebal(s, val); }},
+    {"awb_gain", [](sensor_t *s, int val){ return s->set_awb_gain(s, val); }},
+    {"background", [](sensor_t *s, int val) -> int {
+        background_set_enabled(val);
+        return 0;
+    }, true},
+    {"bg_margin", [](sensor_t *s, int val) -> int {
+        if (val < 0 || val > 255) return -1;
+        background_set_margin(val);
+        return 0;
+    }, true},
+    {"bpc", [](sensor_t *s, int val){ return s->set_bpc(s, val); }},
+    {"brightness", [](sensor_t *s, int val){ return s->set_brightness(s, val); }},
+    {"capture_max_age", [](sensor_t *s, int val) -> int {
+        if(val < 0) return -1;
+        capture_cache_set_max_age(val);
+        return 0;
+    }},
+    {"class", [](sensor_t *s, int val) -> int {
+        return classifier_select(val) ? 0 : -1;
+    }},
+    {"class_bmax", [](sensor_t *s, int val) -> int {
+        return classifier_set(CLASS_BMAX, val) ? 0 : -1;
+    }, true},
+    {"class_bmin", [](sensor_t *s, int val) -> int {
+        return classifier_set(CLASS_BMIN, val) ? 0 : -1;
+    }, true},
+    {"class_gmax", [](sensor_t *s, int val) -> int {
+        return classifier_set(CLASS_GMAX, val) ? 0 : -1;
+    }, true},
+    {"class_gmin", [](sensor_t *s, int val) -> int {
+        return classifier_set(CLASS_GMIN, val) ? 0 : -1;
+    }, true},
+    {"class_on", [](sensor_t *s, int val) -> int {
+        return classifier_set(CLASS_ON, val) ? 0 : -1;
+    }, true},
+    {"class_rmax", [](sensor_t *s, int val) -> int {
+        return classifier_set(CLASS_RMAX, val) ? 0 : -1;
+    }, true},
+    {"class_rmin", [](sensor_t *s, int val) -> int {
+        return classifier_set(CLASS_RMIN, val) ? 0 : -1;
+    }, true},
+    {"colorbar", [](sensor_t *s, int val){ return s->set_colorbar(s, val); }},
+    {"contrast", [](sensor_t *s, int val){ return s->set_contrast(s, val); }},
+    {"dcw", [](sensor_t *s, int val){ return s->set_dcw(s, val); }},
+    {"face_budget", [](sensor_t *s, int val) -> int {
+        if (val <= 0) return -1;
+        mtmn_tuner_set_budget(val);
+        return 0;
+    }},
+    {"face_detect", [](sensor_t *s, int val) -> int {
+        detection_enabled = val;
+        if(!detection_enabled) {
+            recognition_enabled = 0;
+            matrix_cache_trim();
+        }
+        return 0;
+    }},
+    {"face_enroll", [](sensor_t *s, int val) -> int {
+        is_enrolling = val;
+        return 0;
+    }},
+    {"face_every", [](sensor_t *s, int val) -> int {
+        face_tracker_set_every(val);
+        return 0;
+    }},
+    {"face_recognize", [](sensor_t *s, int val) -> int {
+        recognition_enabled = val;
+        if(recognition_enabled){
+            detection_enabled = val;
+        }
+        return 0;
+    }},
+    {"face_tune", [](sensor_t *s, int val) -> int {
+        mtmn_tuner_set_enabled(val);
+        return 0;
+    }},
+    {"framesize", [](sensor_t *s, int val) -> int {
+        // raw frame buffers are sized at init, they can only shrink
+        if(s->pixformat == PIXFORMAT_JPEG || val <= camera_max_framesize){
+            mem_budget_rewarm(); //the pipelines size their buffers to the new frames
+            return s->set_framesize(s, (framesize_t)val);
+        }
+        return 0;
+    }},
+    {"gainceiling", [](sensor_t *s, int val){ return s->set_gainceiling(s, (gainceiling_t)val); }},
+    {"hmirror", [](sensor_t *s, int val){ return s->set_hmirror(s, val); }},
+    {"lenc", [](sensor_t *s, int val){ return s->set_lenc(s, val); }},
+    {"morph_dilate", [](sensor_t *s, int val) -> int {
+        if (val < 0 || val > MORPH_MAX_RADIUS) return -1;
+        morph_dilate_radius = val;
+        return 0;
+    }, true},
+    {"morph_open", [](sensor_t *s, int val) -> int {
+        if (val < 0 || val > MORPH_MAX_RADIUS) return -1;
+        morph_open_radius = val;
+        return 0;
+    }, true},
+    {"motion", [](sensor_t *s, int val) -> int {
+        motion_gate_set_enabled(val);
+        return 0;
+    }},
+    {"motion_threshold", [](sensor_t *s, int val) -> int {
+        if (val < 1 || val > 255) return -1;
+        motion_gate_set_threshold(val);
+        return 0;
+    }},
+    {"quality", [](sensor_t *s, int val){ return s->set_quality(s, val); }},
+    {"raw_gma", [](sensor_t *s, int val){ return s->set_raw_gma(s, val); }},
+    {"roi_pick", [](sensor_t *s, int val) -> int {
+        stream_roi_pick(val);
+        return 0;
+    }},
+    {"roi_size", [](sensor_t *s, int val) -> int {
+        stream_roi_set_size(val);
+        return 0;
+    }},
+    {"saturation", [](sensor_t *s, int val){ return s->set_saturation(s, val); }},
+    {"special_effect", [](sensor_t *s, int val){ return s->set_special_effect(s, val); }},
+    {"stream_adapt", [](sensor_t *s, int val) -> int {
+        stream_rate_set_adaptive(val);
+        return 0;
+    }},
+    {"stream_bw", [](sensor_t *s, int val) -> int {
+        if(val <= 0) return -1;
+        stream_rate_set_targets(val * 1000, 0);
+        return 0;
+    }},
+    {"stream_latency", [](sensor_t *s, int val) -> int {
+        if(val <= 0) return -1;
+        stream_rate_set_targets(0, val);
+        return 0;
+    }},
+    {"stream_quality", [](sensor_t *s, int val) -> int {
+        if(val < STREAM_RATE_Q_MIN || val > STREAM_RATE_Q_MAX) return -1;
+        stream_rate_set_quality(val);
+        return 0;
+    }},
+    {"stream_roi", [](sensor_t *s, int val) -> int {
+        if(val < ROI_OFF || val > ROI_INSET) return -1;
+        stream_roi_set_mode(val);
+        return 0;
+    }},
+    {"tiled", [](sensor_t *s, int val) -> int {
+        if(val < TILED_OFF || val > TILED_AUTO) return -1;
+        tiled_mode = val;
+        return 0;
+    }, true},
+    {"tiled_coarse", [](sensor_t *s, int val) -> int {
+        if(val < 0 || val > TILED_COARSE_MAX) return -1;
+        tiled_coarse = val;
+        return 0;
+    }, true},
+    {"vflip", [](sensor_t *s, int val){ return s->set_vflip(s, val); }},
+    {"wb_mode", [](sensor_t *s, int val){ return s->set_wb_mode(s, val); }},
+    {"wpc", [](sensor_t *s, int val){ return s->set_wpc(s, val); }},
+};
+
+#define CONTROL_SETTERS (sizeof(control_setters) / sizeof(control_setters[0]))
+
+// both control paths can run at once, the sensor registers take one writer
+static SemaphoreHandle_t control_lock = xSemaphoreCreateMutex();
+
+static void control_table_check(){
+    for (size_t i = 1; i < CONTROL_SETTERS; ++i) {
+        if (strcmp(control_setters[i - 1].name, control_setters[i].name) >= 0) {
+            Serial.printf("control table: %s is out of order\n", control_setters[i].name);
+        }
+    }
+}
+
+// 0 on success, -1 for an unknown variable or a rejected value
+static int control_set(const char *name, int val){
+    size_t lo = 0;
+    size_t hi = CONTROL_SETTERS;
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        const int cmp = strcmp(name, control_setters[mid].name);
+        if (!cmp) {
+            const control_setter_t &c = control_setters[mid];
+            xSemaphoreTake(control_lock, portMAX_DELAY);
+            if (c.detector)
+                xSemaphoreTake(detector_lock, portMAX_DELAY);
+            const int res = c.set(esp_camera_sensor_get(), val);
+            if (c.detector) {
+                if (!res)
+                    detector_generation++;
+                xSemaphoreGive(detector_lock);
+            }
+            xSemaphoreGive(control_lock);
+            return res ? -1 : 0;
+        }
+        if (cmp < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return -1;
 }
 
 static esp_err_t cmd_handler(httpd_req_t *req){
@@ -1166,102 +1483,346 @@ static esp_err_t cmd_handler(httpd_req_t *req){
     }
 
     int val = atoi(value);
-    sensor_t * s = esp_camera_sensor_get();
-    int res = 0;
+    int res = control_set(variable, val);
 
-    if(!strcmp(variable, "framesize")) {
-        if(s->pixformat == PIXFORMAT_JPEG) res = s->set_framesize(s, (framesize_t)val);
+    if(res){
+        return httpd_resp_send_500(req);
     }
-    else if(!strcmp(variable, "quality")) res = s->set_quality(s, val);
-    else if(!strcmp(variable, "contrast")) res = s->set_contrast(s, val);
-    else if(!strcmp(variable, "brightness")) res = s->set_brightness(s, val);
-    else if(!strcmp(variable, "saturation")) res = s->set_saturation(s, val);
-    else if(!strcmp(variable, "gainceiling")) res = s->set_gainceiling(s, (gainceiling_t)val);
-    else if(!strcmp(variable, "colorbar")) res = s->set_colorbar(s, val);
-    else if(!strcmp(variable, "awb")) res = s->set_whitebal(s, val);
-    else if(!strcmp(variable, "agc")) res = s->set_gain_ctrl(s, val);
-    else if(!strcmp(variable, "aec")) res = s->set_exposure_ctrl(s, val);
-    else if(!strcmp(variable, "hmirror")) res = s->set_hmirror(s, val);
-    else if(!strcmp(variable, "vflip")) res = s->set_vflip(s, val);
-    else if(!strcmp(variable, "awb_gain")) res = s->set_awb_gain(s, val);
-    else if(!strcmp(variable, "agc_gain")) res = s->set_agc_gain(s, val);
-    else if(!strcmp(variable, "aec_value")) res = s->set_aec_value(s, val);
-    else if(!strcmp(variable, "aec2")) res = s->set_aec2(s, val);
-    else if(!strcmp(variable, "dcw")) res = s->set_dcw(s, val);
-    else if(!strcmp(variable, "bpc")) res = s->set_bpc(s, val);
-    else if(!strcmp(variable, "wpc")) res = s->set_wpc(s, val);
-    else if(!strcmp(variable, "raw_gma")) res = s->set_raw_gma(s, val);
-    else if(!strcmp(variable, "lenc")) res = s->set_lenc(s, val);
-    else if(!strcmp(variable, "special_effect")) res = s->set_special_effect(s, val);
-    else if(!strcmp(variable, "wb_mode")) res = s->set_wb_mode(s, val);
-    else if(!strcmp(variable, "ae_level")) res = s->set_ae_level(s, val);
-    else if(!strcmp(variable, "face_detect")) {
-        detection_enabled = val;
-        if(!detection_enabled) {
-            recognition_enabled = 0;
+
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+// writes the status object, under key when it is a member of another object
+static void status_json(JsonWriter &w, const char *key = NULL){
+    sensor_t * s = esp_camera_sensor_get();
+    w.beginObject(key);
+    w.field("framesize", s->status.framesize);
+    w.field("quality", s->status.quality);
+    w.field("brightness", s->status.brightness);
+    w.field("contrast", s->status.contrast);
+    w.field("saturation", s->status.saturation);
+    w.field("sharpness", s->status.sharpness);
+    w.field("special_effect", s->status.special_effect);
+    w.field("wb_mode", s->status.wb_mode);
+    w.field("awb", s->status.awb);
+    w.field("awb_gain", s->status.awb_gain);
+    w.field("aec", s->status.aec);
+    w.field("aec2", s->status.aec2);
+    w.field("ae_level", s->status.ae_level);
+    w.field("aec_value", s->status.aec_value);
+    w.field("agc", s->status.agc);
+    w.field("agc_gain", s->status.agc_gain);
+    w.field("gainceiling", s->status.gainceiling);
+    w.field("bpc", s->status.bpc);
+    w.field("wpc", s->status.wpc);
+    w.field("raw_gma", s->status.raw_gma);
+    w.field("lenc", s->status.lenc);
+    w.field("vflip", s->status.vflip);
+    w.field("hmirror", s->status.hmirror);
+    w.field("dcw", s->status.dcw);
+    w.field("colorbar", s->status.colorbar);
+    w.field("face_detect", detection_enabled);
+    w.field("face_enroll", is_enrolling);
+    w.field("face_recognize", recognition_enabled);
+    face_tracker_stats_t faces;
+    face_tracker_get_stats(&faces);
+    w.field("face_every", face_tracker_every());
+    w.field("face_every_n", faces.every);
+    w.field("face_detect_us", faces.detect_us);
+    face_worker_stats_t worker;
+    face_worker_get_stats(&worker);
+    w.field("face_recognize_us", worker.last_us);
+    mtmn_tuner_state_t tuner;
+    mtmn_tuner_get(&tuner);
+    w.field("face_tune", tuner.enabled);
+    w.field("face_budget", tuner.budget_ms);
+    w.beginObject("face_profile");
+    w.field("index", tuner.profile);
+    w.field("min_face", tuner.min_face);
+    w.field("pyramid_milli", tuner.pyramid_milli);
+    w.field("pyramid_times", tuner.pyramid_times);
+    w.field("detect_us", tuner.detect_us);
+    w.field("predicted_us", tuner.predicted_us);
+    w.field("switches", tuner.switches);
+    w.endObject();
+    tiled_stats_t tiled;
+    tiled_get_stats(&tiled);
+    w.field("tiled", tiled_mode);
+    w.field("tiled_us", tiled.last_us);
+    w.field("tiled_coarse", tiled_coarse);
+    w.field("tiled_windows", tiled.windows);
+    w.field("tiled_pixels", tiled.window_pixels);
+    w.field("tiled_coarse_us", tiled.coarse_us);
+    w.field("morph_dilate", morph_dilate_radius);
+    w.field("morph_open", morph_open_radius);
+    stream_rate_t rate;
+    stream_rate_get(&rate);
+    w.field("stream_adapt", rate.adaptive);
+    w.field("stream_quality", rate.quality);
+    w.field("stream_decimation", rate.decimation);
+    w.field("stream_bw", rate.bps / 1000);
+    w.field("stream_bw_target", rate.target_bps / 1000);
+    w.field("stream_latency", rate.latency_ms);
+    w.field("stream_latency_target", rate.target_latency_ms);
+    w.field("stream_encode_us", rate.encode_us);
+    w.field("stream_behind", rate.behind);
+    w.field("stream_roi", stream_roi_mode());
+    w.field("roi_size", stream_roi_size());
+    w.field("capture_max_age", capture_cache_max_age());
+    motion_gate_stats_t motion;
+    motion_gate_get_stats(&motion);
+    w.field("motion", motion.enabled);
+    w.field("motion_threshold", motion.threshold);
+    w.field("motion_blocks", motion.changed);
+    w.field("motion_us", motion.last_us);
+    background_stats_t background;
+    background_get_stats(&background);
+    w.field("background", background.enabled);
+    w.field("bg_margin", background.margin);
+    w.field("bg_us", background.last_us);
+    classifier_stats_t classifier;
+    classifier_get_stats(&classifier);
+    classifier_class_t cls;
+    classifier_get(classifier.selected, &cls);
+    w.field("class", classifier.selected);
+    w.field("class_on", cls.enabled);
+    w.field("class_rmin", cls.min[0]);
+    w.field("class_rmax", cls.max[0]);
+    w.field("class_gmin", cls.min[1]);
+    w.field("class_gmax", cls.max[1]);
+    w.field("class_bmin", cls.min[2]);
+    w.field("class_bmax", cls.max[2]);
+    w.field("classes", classifier.enabled);
+    w.endObject();
+}
+
+// JSON responses go out in JSON_CHUNK_SIZE pieces from the handler's stack
+static esp_err_t json_finish(httpd_req_t *req, JsonWriter &w){
+    if (!w.finish())
+        return ESP_FAIL;
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t status_handler(httpd_req_t *req){
+    char chunk[JSON_CHUNK_SIZE];
+    JsonWriter w(chunk, sizeof(chunk), json_httpd_chunk, req);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    status_json(w);
+    return json_finish(req, w);
+}
+
+// One WebSocket message is a batch of "var=val" pairs separated by '&' or
+// newlines, applied in order through the /control table. An optional seq=N is
+// echoed back. The reply acknowledges the batch with the names that failed and
+// the status that resulted.
+static size_t control_batch(char *message, size_t len, char *reply, size_t reply_len){
+    char failed_buf[256];
+    JsonWriter failed(failed_buf, sizeof(failed_buf));
+    uint32_t applied = 0;
+    int32_t seq = -1;
+    char *save = NULL;
+
+    failed.beginArray();
+    for (char *pair = strtok_r(message, "&\r\n", &save); pair; pair = strtok_r(NULL, "&\r\n", &save)) {
+        char *eq = strchr(pair, '=');
+        if (eq) {
+            *eq = 0;
+            if (!strcmp(pair, "seq")) {
+                seq = atoi(eq + 1);
+                continue;
+            }
+            if (!control_set(pair, atoi(eq + 1))) {
+                applied++;
+                continue;
+            }
         }
-    }
-    else if(!strcmp(variable, "face_enroll")) is_enrolling = val;
-    else if(!strcmp(variable, "face_recognize")) {
-        recognition_enabled = val;
-        if(recognition_enabled){
-            detection_enabled = val;
+        // names are echoed back, anything unexpected is masked and long ones cut
+        for (char *c = pair; *c; ++c) {
+            if (!isalnum((unsigned char)*c) && *c != '_') *c = '?';
         }
+        if (strlen(pair) > 32) pair[32] = 0;
+        // room for the quoted name, its comma and the closing bracket
+        if (failed.size() + strlen(pair) + 4 <= sizeof(failed_buf)) failed.field(NULL, pair);
     }
-    else {
-        res = -1;
+    failed.endArray();
+
+    JsonWriter w(reply, reply_len);
+    w.beginObject();
+    w.field("seq", seq);
+    w.field("applied", applied);
+    w.raw("failed", failed_buf, failed.size());
+    status_json(w, "status");
+    w.endObject();
+    if (!w.finish()) {
+        JsonWriter error(reply, reply_len);
+        error.beginObject();
+        error.field("seq", seq);
+        error.field("applied", applied);
+        error.field("error", "reply too long");
+        error.endObject();
+        return error.size();
     }
+    return w.size();
+}
 
-    if(res){
-        return httpd_resp_send_500(req);
-    }
+static esp_err_t memory_handler(httpd_req_t *req){
+    char chunk[JSON_CHUNK_SIZE];
+    JsonWriter w(chunk, sizeof(chunk), json_httpd_chunk, req);
+    jpeg_pool_stats_t pool;
+    jpeg_pool_get_stats(&pool);
 
+    httpd_resp_set_type(req, "application/json");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    return httpd_resp_send(req, NULL, 0);
+    w.beginObject();
+    mem_budget_write_json(w);
+    w.beginObject("arenas");
+    frame_arena_write_json(w);
+    w.endObject();
+    w.beginObject("jpeg_pool");
+    w.field("slots", (uint32_t)JPEG_POOL_SIZE);
+    w.field("in_use", pool.in_use);
+    w.field("capacity", pool.capacity);
+    w.field("average", pool.average);
+    w.field("acquired", pool.acquired);
+    w.field("exhausted", pool.exhausted);
+    w.field("grows", pool.grows);
+    w.field("shrinks", pool.shrinks);
+    w.endObject();
+    matrix_cache_stats_t matrices;
+    matrix_cache_get_stats(&matrices);
+    w.beginObject("matrix_cache");
+    w.field("hits", matrices.hits);
+    w.field("allocs", matrices.allocs);
+    w.field("overflow", matrices.overflow);
+    w.field("bytes", matrices.bytes);
+    w.endObject();
+    w.endObject();
+    return json_finish(req, w);
 }
 
-static esp_err_t status_handler(httpd_req_t *req){
-    static char json_response[1024];
+// a frame of its own, so it holds the pixels before loop() draws the crosses
+static esp_err_t raw_handler(httpd_req_t *req){
+    char query[96] = {0,};
+    char value[16] = {0,};
+    raw_frame_window_t window = {0, 0, 0, 0, 1};
+    static const char *keys[5] = {"x", "y", "w", "h", "step"};
+    uint32_t *fields[5] = {&window.x, &window.y, &window.w, &window.h, &window.step};
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        for (int i = 0; i < 5; ++i){
+            if (httpd_query_key_value(query, keys[i], value, sizeof(value)) != ESP_OK)
+                continue;
+            const int v = atoi(value);
+            if (v < 0){
+                httpd_resp_set_status(req, "400 Bad Request");
+                return httpd_resp_send(req, NULL, 0);
+            }
+            *fields[i] = v;
+        }
+    }
 
-    sensor_t * s = esp_camera_sensor_get();
-    char * p = json_response;
-    *p++ = '{';
-
-    p+=sprintf(p, "\"framesize\":%u,", s->status.framesize);
-    p+=sprintf(p, "\"quality\":%u,", s->status.quality);
-    p+=sprintf(p, "\"brightness\":%d,", s->status.brightness);
-    p+=sprintf(p, "\"contrast\":%d,", s->status.contrast);
-    p+=sprintf(p, "\"saturation\":%d,", s->status.saturation);
-    p+=sprintf(p, "\"sharpness\":%d,", s->status.sharpness);
-    p+=sprintf(p, "\"special_effect\":%u,", s->status.special_effect);
-    p+=sprintf(p, "\"wb_mode\":%u,", s->status.wb_mode);
-    p+=sprintf(p, "\"awb\":%u,", s->status.awb);
-    p+=sprintf(p, "\"awb_gain\":%u,", s->status.awb_gain);
-    p+=sprintf(p, "\"aec\":%u,", s->status.aec);
-    p+=sprintf(p, "\"aec2\":%u,", s->status.aec2);
-    p+=sprintf(p, "\"ae_level\":%d,", s->status.ae_level);
-    p+=sprintf(p, "\"aec_value\":%u,", s->status.aec_value);
-    p+=sprintf(p, "\"agc\":%u,", s->status.agc);
-    p+=sprintf(p, "\"agc_gain\":%u,", s->status.agc_gain);
-    p+=sprintf(p, "\"gainceiling\":%u,", s->status.gainceiling);
-    p+=sprintf(p, "\"bpc\":%u,", s->status.bpc);
-    p+=sprintf(p, "\"wpc\":%u,", s->status.wpc);
-    p+=sprintf(p, "\"raw_gma\":%u,", s->status.raw_gma);
-    p+=sprintf(p, "\"lenc\":%u,", s->status.lenc);
-    p+=sprintf(p, "\"vflip\":%u,", s->status.vflip);
-    p+=sprintf(p, "\"hmirror\":%u,", s->status.hmirror);
-    p+=sprintf(p, "\"dcw\":%u,", s->status.dcw);
-    p+=sprintf(p, "\"colorbar\":%u,", s->status.colorbar);
-    p+=sprintf(p, "\"face_detect\":%u,", detection_enabled);
-    p+=sprintf(p, "\"face_enroll\":%u,", is_enrolling);
-    p+=sprintf(p, "\"face_recognize\":%u", recognition_enabled);
-    *p++ = '}';
-    *p++ = 0;
+    camera_fb_t * fb = esp_camera_fb_get();
+    if (!fb) {
+        Serial.println("Camera capture failed");
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    const int64_t captured = esp_timer_get_time();
+    esp_err_t res = raw_frame_send(req, fb, window, captured);
+    esp_camera_fb_return(fb);
+    if (res == ESP_ERR_INVALID_ARG) {
+        httpd_resp_set_status(req, "400 Bad Request");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    return res;
+}
+
+static esp_err_t bench_handler(httpd_req_t *req){
+    char chunk[JSON_CHUNK_SIZE];
+    JsonWriter w(chunk, sizeof(chunk), json_httpd_chunk, req);
+    char query[64] = {0,};
+    char value[16] = {0,};
+    uint32_t width = 160;
+    uint32_t height = 120;
+    int targets = -1; //set for the blob search benchmark
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "w", value, sizeof(value)) == ESP_OK) {
+            width = atoi(value);
+        }
+        if (httpd_query_key_value(query, "h", value, sizeof(value)) == ESP_OK) {
+            height = atoi(value);
+        }
+        if (httpd_query_key_value(query, "search", value, sizeof(value)) == ESP_OK) {
+            targets = atoi(value);
+        }
+    }
+    if (!width || !height || width > 1600 || height > 1200 || targets == 0) {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
     httpd_resp_set_type(req, "application/json");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    return httpd_resp_send(req, json_response, strlen(json_response));
+    if (targets > 0)
+        bench_blob_search(w, targets, detector_lock);
+    else
+        bench_placement(w, width, height);
+    return json_finish(req, w);
 }
 
+#if PROFILER_ENABLED
+static esp_err_t profile_handler(httpd_req_t *req){
+    char query[64] = {0,};
+    char cmd[16] = {0,};
+    char value[16] = {0,};
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        httpd_query_key_value(query, "cmd", cmd, sizeof(cmd));
+    }
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_type(req, "text/plain");
+
+    if(!strcmp(cmd, "start")) {
+        uint32_t hz = 0;
+        if (httpd_query_key_value(query, "hz", value, sizeof(value)) == ESP_OK) {
+            hz = atoi(value);
+        }
+        if (!profiler_start(hz)) {
+            return httpd_resp_send_500(req);
+        }
+        return httpd_resp_send(req, "started\n", 8);
+    }
+    if(!strcmp(cmd, "stop")) {
+        profiler_stop();
+        return httpd_resp_send(req, "stopped\n", 8);
+    }
+
+    // a dump stops sampling so the buffer is not appended to while it is read
+    profiler_stop();
+    char line[16 + PROFILER_DEPTH * 11];
+    size_t count = profiler_count();
+    int len = snprintf(line, sizeof(line), "# samples %u dropped %u\n", count, profiler_dropped());
+    esp_err_t res = httpd_resp_send_chunk(req, line, len);
+    for (size_t i = 0; i < count && res == ESP_OK; ++i) {
+        const profiler_sample_t *sample = profiler_sample(i);
+        char *p = line;
+        p += sprintf(p, "%u", sample->core);
+        for (int d = 0; d < sample->depth; ++d) {
+            p += sprintf(p, " %08x", sample->pc[d]);
+        }
+        *p++ = '\n';
+        res = httpd_resp_send_chunk(req, line, p - line);
+    }
+    if (res == ESP_OK) {
+        res = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return res;
+}
+#endif
+
 static esp_err_t index_handler(httpd_req_t *req){
     httpd_resp_set_type(req, "text/html");
     httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
@@ -1274,6 +1835,7 @@ static esp_err_t index_handler(httpd_req_t *req){
 
 void startCameraServer(){
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.max_uri_handlers = 12;
 
     httpd_uri_t index_uri = {
         .uri       = "/",
@@ -1303,6 +1865,36 @@ void startCameraServer(){
         .user_ctx  = NULL
     };
 
+    httpd_uri_t memory_uri = {
+        .uri       = "/memory",
+        .method    = HTTP_GET,
+        .handler   = memory_handler,
+        .user_ctx  = NULL
+    };
+
+    httpd_uri_t raw_uri = {
+        .uri       = "/raw",
+        .method    = HTTP_GET,
+        .handler   = raw_handler,
+        .user_ctx  = NULL
+    };
+
+    httpd_uri_t bench_uri = {
+        .uri       = "/bench",
+        .method    = HTTP_GET,
+        .handler   = bench_handler,
+        .user_ctx  = NULL
+    };
+
+#if PROFILER_ENABLED
+    httpd_uri_t profile_uri = {
+        .uri       = "/profile",
+        .method    = HTTP_GET,
+        .handler   = profile_handler,
+        .user_ctx  = NULL
+    };
+#endif
+
    httpd_uri_t stream_uri = {
         .uri       = "/stream",
         .method    = HTTP_GET,
@@ -1310,8 +1902,18 @@ void startCameraServer(){
         .user_ctx  = NULL
     };
 
+    httpd_uri_t dots_uri = {
+        .uri       = "/dots",
+        .method    = HTTP_GET,
+        .handler   = dots_handler,
+        .user_ctx  = NULL
+    };
+
 
     ra_filter_init(&ra_filter, 20);
+
+    stream_frames = xQueueCreate(1, sizeof(camera_fb_t *));
+    xTaskCreatePinnedToCore(stream_encode_task, "stream_encode", 8192, NULL, 2, NULL, 0);
     
     mtmn_config.type = FAST;
     mtmn_config.min_face = 80;
@@ -1326,8 +1928,10 @@ void startCameraServer(){
     mtmn_config.o_threshold.score = 0.7;
     mtmn_config.o_threshold.nms = 0.7;
     mtmn_config.o_threshold.candidate_number = 1;
+    mtmn_tuner_init(&mtmn_config);
     
     face_id_init(&id_list, FACE_ID_SAVE_NUMBER, ENROLL_CONFIRM_TIMES);
+    face_worker_start(FACE_WIDTH, FACE_HEIGHT, recognize_aligned);
     
     Serial.printf("Starting web server on port: '%d'\n", config.server_port);
     if (httpd_start(&camera_httpd, &config) == ESP_OK) {
@@ -1335,6 +1939,12 @@ void startCameraServer(){
         httpd_register_uri_handler(camera_httpd, &cmd_uri);
         httpd_register_uri_handler(camera_httpd, &status_uri);
         httpd_register_uri_handler(camera_httpd, &capture_uri);
+        httpd_register_uri_handler(camera_httpd, &memory_uri);
+        httpd_register_uri_handler(camera_httpd, &bench_uri);
+        httpd_register_uri_handler(camera_httpd, &raw_uri);
+#if PROFILER_ENABLED
+        httpd_register_uri_handler(camera_httpd, &profile_uri);
+#endif
     }
 
     config.server_port += 1;
@@ -1342,5 +1952,10 @@ void startCameraServer(){
     Serial.printf("Starting stream server on port: '%d'\n", config.server_port);
     if (httpd_start(&stream_httpd, &config) == ESP_OK) {
         httpd_register_uri_handler(stream_httpd, &stream_uri);
+        httpd_register_uri_handler(stream_httpd, &dots_uri);
     }
+
+    control_table_check();
+    Serial.printf("Starting control channel on port: '%d'\n", config.server_port + 1);
+    control_ws_start(config.server_port + 1, control_batch);
 }
\ No newline at end of file
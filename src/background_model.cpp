@@ -0,0 +1,156 @@
+#include "background_model.h"
+#include "esp_timer.h"
+
+static uint8_t *model = NULL;
+static uint16_t model_width = 0;  //frame size the model is for
+static uint16_t model_height = 0;
+static uint16_t stride = 0;       //cells per row, padded to whole words
+static bool ready = false;        //the model has learned at least one frame
+static background_stats_t stats = {true, BG_MARGIN, 0, 0, 0, 0};
+
+// the target being left out of learning
+static uint32_t still_track = 0;
+static uint32_t still_x = 0;
+static uint32_t still_y = 0;
+static uint32_t still_frames = 0;
+
+static inline uint32_t average4(uint32_t a, uint32_t b){
+    return (a & b) + (((a ^ b) >> 1) & 0x7F7F7F7F);
+}
+
+static bool prepare(uint16_t width, uint16_t height){
+    if (model && width == model_width && height == model_height)
+        return true;
+    mem_budget_free(model);
+    ready = false;
+    stats.frames = 0;
+    model_width = width;
+    model_height = height;
+    stats.cols = (width + BG_STEP - 1) / BG_STEP;
+    stats.rows = (height + BG_STEP - 1) / BG_STEP;
+    stride = (stats.cols + 3) & ~3;
+    model = (uint8_t *)mem_budget_malloc(MEM_STAGE_DETECT, stride * stats.rows, MALLOC_CAP_SPIRAM);
+    if (!model){
+        Serial.println("background: could not allocate the model");
+        return false;
+    }
+    memset(model, 0, stride * stats.rows);
+    return true;
+}
+
+static inline uint8_t level(const uint8_t *p, pixformat_t format){
+    switch (format){
+        case PIXFORMAT_RGB888:
+            return background_level(p[0], p[1], p[2]);
+        case PIXFORMAT_RGB565:
+            return background_level(p[0] & 0xF8, ((p[0] & 0x07) << 5) | ((p[1] & 0xE0) >> 3), (p[1] & 0x1F) << 3);
+        default:
+            return p[0];
+    }
+}
+
+// the target's box in cells, grown by a cell; false when there is none to
+// protect
+static bool protected_cells(const Dot *dots, size_t count, uint32_t selected,
+                            int32_t &cx0, int32_t &cy0, int32_t &cx1, int32_t &cy1){
+    const Dot *target = NULL;
+    for (size_t i = 0; selected && i < count; ++i){
+        if (dots[i].id == selected)
+            target = &dots[i];
+    }
+    if (!target){
+        still_track = 0;
+        return false;
+    }
+    const uint32_t cx = target->x + target->w / 2;
+    const uint32_t cy = target->y + target->h / 2;
+    const int32_t dx = (int32_t)cx - (int32_t)still_x;
+    const int32_t dy = (int32_t)cy - (int32_t)still_y;
+    if (target->id != still_track || dx * dx + dy * dy > BG_STEP * BG_STEP){
+        still_track = target->id;
+        still_x = cx;
+        still_y = cy;
+        still_frames = 0;
+    } else if (++still_frames > BG_STILL_FRAMES){
+        // a target that never moves is part of the scene after all
+        return false;
+    }
+    // Dot x is 1-based
+    cx0 = ((int32_t)target->x - 1) / BG_STEP - 1;
+    cy0 = (int32_t)target->y / BG_STEP - 1;
+    cx1 = ((int32_t)(target->x + target->w) - 1) / BG_STEP + 1;
+    cy1 = (int32_t)(target->y + target->h) / BG_STEP + 1;
+    return true;
+}
+
+void background_update(camera_fb_t *fb, const Dot *dots, size_t count, uint32_t selected){
+    const uint32_t bpp = frame_bpp(fb->format);
+    if (!stats.enabled || !bpp || !prepare(fb->width, fb->height)){
+        ready = false;
+        return;
+    }
+    const int64_t start = esp_timer_get_time();
+    const pixformat_t format = fb->format;
+    int32_t cx0 = 0, cy0 = 0, cx1 = -1, cy1 = -1;
+    protected_cells(dots, count, selected, cx0, cy0, cx1, cy1);
+
+    for (uint32_t cy = 0; cy < stats.rows; ++cy){
+        const uint8_t *src = fb->buf + cy * BG_STEP * fb->width * bpp;
+        uint32_t *row = (uint32_t *)(model + cy * stride);
+        const bool guarded = (int32_t)cy >= cy0 && (int32_t)cy <= cy1;
+        for (uint32_t w = 0; w < stride / 4; ++w){
+            uint32_t cur = 0;
+            for (uint32_t k = 0; k < 4; ++k){
+                const uint32_t cx = w * 4 + k;
+                if (cx < stats.cols)
+                    cur |= (uint32_t)level(src + cx * BG_STEP * bpp, format) << (8 * k);
+            }
+            const uint32_t old = row[w];
+            uint32_t bg = average4(old, cur);
+            bg = average4(old, bg);
+            bg = average4(old, bg);
+            bg = average4(old, bg);
+            if (guarded && (int32_t)(w * 4 + 3) >= cx0 && (int32_t)(w * 4) <= cx1){
+                // keep the target's cells as they were
+                for (uint32_t k = 0; k < 4; ++k){
+                    const int32_t cx = w * 4 + k;
+                    if (cx >= cx0 && cx <= cx1){
+                        const uint32_t byte = 0xFFu << (8 * k);
+                        bg = (bg & ~byte) | (old & byte);
+                    }
+                }
+            }
+            row[w] = bg;
+        }
+    }
+    ready = true;
+    stats.frames++;
+    stats.last_us = esp_timer_get_time() - start;
+}
+
+bool background_fits(uint32_t width, uint32_t height){
+    return model && width == model_width && height == model_height;
+}
+
+const uint8_t *background_row(uint32_t y){
+    if (!ready || !stats.enabled)
+        return NULL;
+    const uint32_t cy = y / BG_STEP;
+    return model + (cy < stats.rows ? cy : stats.rows - 1) * stride;
+}
+
+uint8_t background_margin(){
+    return stats.margin;
+}
+
+void background_set_enabled(bool enabled){
+    stats.enabled = enabled;
+}
+
+void background_set_margin(uint8_t margin){
+    stats.margin = margin;
+}
+
+void background_get_stats(background_stats_t *out){
+    *out = stats;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "definations.h"
+#include "esp_camera.h"
+
+// Background model that keeps static bright sources out of blob labeling.
+//
+// The color classes are fixed ranges, so lamps, windows and reflections pass
+// them on every frame. The model holds one byte per BG_STEP x BG_STEP cell in
+// PSRAM: the running average of the cell's level, (R + 2G + B) / 4 for RGB and
+// luma otherwise, which tracks colored markers as well as white ones. A pixel
+// only counts as a hit when classify() gives it a class and it is more than
+// the margin above its cell's background, so a lamp that has been there for a
+// few seconds is masked while the beacon stays visible against whatever is
+// behind it.
+//
+// background_update() runs after detection and learns four cells per word:
+// four halving averages of packed bytes, (a & b) + ((a ^ b) >> 1), move the
+// background 1/16 of the way towards the frame without a multiply. Floor
+// rounding leaves the average up to 15 below a constant level, which is why
+// the default margin is larger than that. The selected target is left out of
+// learning so it does not fade into the background, unless it has sat still
+// for BG_STILL_FRAMES. The model starts dark and takes about 30 frames to
+// learn a new scene, and starts over when the frame size changes.
+
+#define BG_STEP 2
+#define BG_MARGIN 32
+#define BG_STILL_FRAMES 150
+
+static inline uint8_t background_level(int R, int G, int B){
+    return (R + 2 * G + B) >> 2;
+}
+
+typedef struct {
+    bool enabled;
+    uint8_t margin;
+    uint16_t cols;
+    uint16_t rows;
+    uint32_t frames;  //learned since the model was (re)started
+    uint32_t last_us;
+} background_stats_t;
+
+// learns fb; selected is the track id of the target to leave out, 0 for none
+void background_update(camera_fb_t *fb, const Dot *dots, size_t count, uint32_t selected);
+
+// whether the model is for frames of this size; until the first update after
+// a size change it is not, and its rows must not be used
+bool background_fits(uint32_t width, uint32_t height);
+// the background row for frame row y (0-based), NULL when the model is off
+const uint8_t *background_row(uint32_t y);
+// x is the 0-based column
+static inline bool background_foreground(const uint8_t *row, uint32_t x, uint8_t level, uint8_t margin){
+    return !row || level > row[x / BG_STEP] + margin;
+}
+uint8_t background_margin();
+
+void background_set_enabled(bool enabled);
+void background_set_margin(uint8_t margin);
+void background_get_stats(background_stats_t *out);
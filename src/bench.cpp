@@ -0,0 +1,218 @@
+#include "bench.h"
+#include "mem_budget.h"
+#include "definations.h"
+#include "tiled_detector.h"
+#include "color_classifier.h"
+#include "esp_timer.h"
+
+#define BENCH_OPS 20000
+#define BENCH_SEARCH_RUNS 3   //the fastest run is reported
+#define BENCH_TARGET_SIZE 6   //pixels per side
+#define BENCH_MAX_TARGETS 8
+
+typedef uint32_t (*bench_kernel_t)(uint8_t *mem, size_t bytes, uint32_t ops);
+
+static inline uint32_t xorshift(uint32_t &state){
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// random test-and-set on a packed mask, like Bitmap::getCell/setCell
+static uint32_t IRAM_ATTR kernel_packed_mask(uint8_t *mem, size_t bytes, uint32_t ops){
+    uint32_t *words = (uint32_t *)mem;
+    const uint32_t bits = bytes * 8;
+    uint32_t seed = 0x12345678;
+    uint32_t hits = 0;
+    for (uint32_t i = 0; i < ops; ++i){
+        const uint32_t b = xorshift(seed) % bits;
+        if (words[b >> 5] & (1u << (b & 31)))
+            hits++;
+        else
+            words[b >> 5] |= 1u << (b & 31);
+    }
+    return hits;
+}
+
+// the byte-per-pixel mask the detector used before it was packed
+static uint32_t IRAM_ATTR kernel_byte_mask(uint8_t *mem, size_t bytes, uint32_t ops){
+    uint32_t seed = 0x12345678;
+    uint32_t hits = 0;
+    for (uint32_t i = 0; i < ops; ++i){
+        const uint32_t b = xorshift(seed) % bytes;
+        if (mem[b])
+            hits++;
+        else
+            mem[b] = 1;
+    }
+    return hits;
+}
+
+// union-find style parent chasing over a 16-bit label table
+static uint32_t IRAM_ATTR kernel_label_table(uint8_t *mem, size_t bytes, uint32_t ops){
+    uint16_t *labels = (uint16_t *)mem;
+    const uint32_t n = bytes / sizeof(uint16_t);
+    uint32_t seed = 0x9E3779B9;
+    for (uint32_t i = 0; i < n; ++i)
+        labels[i] = i;
+    for (uint32_t i = 0; i < ops; ++i){
+        uint32_t a = xorshift(seed) % n;
+        const uint32_t b = xorshift(seed) % n;
+        while (labels[a] != a)
+            a = labels[a];
+        if (a > b)
+            labels[a] = b;
+    }
+    return labels[n - 1];
+}
+
+// FIFO push/pop through a ring, like DetectQueue
+static uint32_t IRAM_ATTR kernel_queue(uint8_t *mem, size_t bytes, uint32_t ops){
+    uint32_t *ring = (uint32_t *)mem;
+    const uint32_t mask = bytes / sizeof(uint32_t) - 1;
+    uint32_t head = 0, tail = 0, sum = 0;
+    for (uint32_t i = 0; i < ops; ++i){
+        ring[tail++ & mask] = i;
+        ring[tail++ & mask] = i + 1;
+        sum += ring[head++ & mask];
+        if (tail - head > mask)
+            head = tail - mask;
+    }
+    return sum;
+}
+
+// per-frame scan of the tracked dots
+static uint32_t IRAM_ATTR kernel_track_table(uint8_t *mem, size_t bytes, uint32_t ops){
+    Dot *dots = (Dot *)mem;
+    const uint32_t n = bytes / sizeof(Dot);
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < ops; ++i){
+        Dot &d = dots[i % n];
+        d.x += 1;
+        sum += d.x + d.y + d.w + d.h;
+    }
+    return sum;
+}
+
+static uint32_t run(bench_kernel_t kernel, uint32_t caps, size_t bytes, bool *ok){
+    uint8_t *mem = (uint8_t *)mem_budget_malloc(MEM_STAGE_HTTP, bytes, caps);
+    if (!mem){
+        *ok = false;
+        return 0;
+    }
+    memset(mem, 0, bytes);
+    volatile uint32_t sink;
+    const uint32_t start = ESP.getCycleCount();
+    sink = kernel(mem, bytes, BENCH_OPS);
+    const uint32_t cycles = ESP.getCycleCount() - start;
+    (void)sink;
+    mem_budget_free(mem);
+    *ok = true;
+    return cycles;
+}
+
+void bench_placement(JsonWriter &w, uint32_t width, uint32_t height){
+    struct {
+        const char *name;
+        bench_kernel_t kernel;
+        size_t bytes;
+    } cases[] = {
+        {"packed_mask", kernel_packed_mask, ((height + 1) * width + 31) / 32 * 4},
+        {"byte_mask", kernel_byte_mask, (height + 1) * width},
+        {"label_table", kernel_label_table, 4096 * sizeof(uint16_t)},
+        {"queue", kernel_queue, DETECT_RING * sizeof(uint32_t)},
+        {"track_table", kernel_track_table, DOTS_MAX * sizeof(Dot)},
+    };
+    w.beginObject();
+    w.field("width", width);
+    w.field("height", height);
+    w.field("ops", (uint32_t)BENCH_OPS);
+    w.beginArray("results");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]) && w.ok(); ++i){
+        bool dram_ok, psram_ok;
+        const uint32_t dram = run(cases[i].kernel, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT, cases[i].bytes, &dram_ok);
+        const uint32_t psram = run(cases[i].kernel, MALLOC_CAP_SPIRAM, cases[i].bytes, &psram_ok);
+        w.beginObject();
+        w.field("structure", cases[i].name);
+        w.field("bytes", cases[i].bytes);
+        w.field("dram_cycles", dram);
+        w.field("psram_cycles", psram);
+        w.field("ok", (int32_t)(dram_ok && psram_ok));
+        w.endObject();
+    }
+    w.endArray();
+    w.endObject();
+}
+
+// dark frame with targets spread over it, the same ones relative to any size
+static void draw_targets(uint8_t *frame, uint32_t width, uint32_t height, uint32_t targets){
+    memset(frame, 0x10, width * height);
+    uint32_t seed = 0x2545F491;
+    for (uint32_t t = 0; t < targets; ++t){
+        const uint32_t x = (xorshift(seed) % 1000) * (width - BENCH_TARGET_SIZE) / 1000;
+        const uint32_t y = (xorshift(seed) % 1000) * (height - BENCH_TARGET_SIZE) / 1000;
+        for (uint32_t r = 0; r < BENCH_TARGET_SIZE; ++r)
+            memset(frame + (y + r) * width + x, 0xFF, BENCH_TARGET_SIZE);
+    }
+}
+
+void bench_blob_search(JsonWriter &w, uint32_t targets, SemaphoreHandle_t detector_lock){
+    static const uint16_t sizes[][2] = {{320, 240}, {640, 480}, {800, 600}, {1024, 768}, {1280, 1024}, {1600, 1200}};
+    static const uint8_t steps[] = {0, 4, 8};
+    if (targets > BENCH_MAX_TARGETS)
+        targets = BENCH_MAX_TARGETS;
+
+    w.beginObject();
+    w.field("targets", targets);
+    w.field("runs", (uint32_t)BENCH_SEARCH_RUNS);
+    w.beginArray("results");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && w.ok(); ++i){
+        const uint32_t width = sizes[i][0];
+        const uint32_t height = sizes[i][1];
+        uint8_t *frame = (uint8_t *)mem_budget_malloc(MEM_STAGE_HTTP, width * height, MALLOC_CAP_SPIRAM);
+        if (frame)
+            draw_targets(frame, width, height, targets);
+        camera_fb_t fb;
+        memset(&fb, 0, sizeof(fb));
+        fb.buf = frame;
+        fb.len = width * height;
+        fb.width = width;
+        fb.height = height;
+        fb.format = PIXFORMAT_GRAYSCALE;
+
+        for (size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); ++s){
+            uint32_t best = 0xFFFFFFFF;
+            int found = 0;
+            tiled_stats_t stats = {0};
+            for (int run = 0; frame && run < BENCH_SEARCH_RUNS; ++run){
+                Dot dots[DOTS_MAX];
+                xSemaphoreTake(detector_lock, portMAX_DELAY);
+                classifier_begin_frame();
+                const int64_t start = esp_timer_get_time();
+                found = tiled_detect(&fb, dots, DOTS_MAX, steps[s], false);
+                const uint32_t us = esp_timer_get_time() - start;
+                tiled_get_stats(&stats);
+                frame_arena_dram.reset();
+                frame_arena_psram.reset();
+                xSemaphoreGive(detector_lock);
+                if (us < best)
+                    best = us;
+            }
+            w.beginObject();
+            w.field("width", width);
+            w.field("height", height);
+            w.field("coarse", (uint32_t)steps[s]);
+            w.field("us", frame ? best : 0);
+            w.field("coarse_us", stats.coarse_us);
+            w.field("windows", stats.windows);
+            w.field("pixels", stats.window_pixels);
+            w.field("dots", (int32_t)found);
+            w.field("ok", (int32_t)(frame != NULL));
+            w.endObject();
+        }
+        mem_budget_free(frame);
+    }
+    w.endArray();
+    w.endObject();
+}
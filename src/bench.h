@@ -0,0 +1,15 @@
+#pragma once
+#include "Arduino.h"
+#include "json_writer.h"
+
+// On-device micro benchmarks, reported as JSON through /bench.
+
+// Runs the detector's access pattern for each hot structure once against an
+// internal DRAM buffer and once against a PSRAM buffer of the same size.
+void bench_placement(JsonWriter &w, uint32_t width, uint32_t height);
+
+// Times the tiled detector on synthetic grayscale frames of growing size, each
+// with the same targets, once labeling the whole frame and once per coarse
+// step. detector_lock is held around every run, so loop()'s detector and its
+// frame arenas are left alone.
+void bench_blob_search(JsonWriter &w, uint32_t targets, SemaphoreHandle_t detector_lock);
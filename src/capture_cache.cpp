@@ -0,0 +1,77 @@
+#include "capture_cache.h"
+#include "esp_timer.h"
+
+static SemaphoreHandle_t cache_lock = xSemaphoreCreateMutex();
+static jpeg_frame_t *cached = NULL;
+static uint32_t cached_motion = 0; //motion gate frame when cached was taken
+static uint32_t max_age_ms = CAPTURE_MAX_AGE_MS;
+static capture_cache_stats_t stats;
+
+static bool fresh(const jpeg_frame_t *frame){
+    return frame && esp_timer_get_time() - frame->timestamp < (int64_t)max_age_ms * 1000;
+}
+
+// cache_lock held
+static void replace(jpeg_frame_t *frame){
+    if (cached)
+        jpeg_frame_release(cached);
+    cached = frame;
+    cached_motion = motion_gate_frame();
+}
+
+jpeg_frame_t *capture_cache_get(capture_producer_t produce, void *arg){
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    if (fresh(cached)){
+        stats.hits++;
+    } else {
+        stats.misses++;
+        jpeg_frame_t *frame = produce(arg);
+        if (frame)
+            replace(frame);
+        else if (cached){
+            // keep serving the old frame rather than failing the request
+            Serial.println("capture: producing a frame failed, serving a stale one");
+        }
+    }
+    jpeg_frame_t *frame = cached;
+    if (frame)
+        jpeg_frame_ref(frame);
+    xSemaphoreGive(cache_lock);
+    return frame;
+}
+
+void capture_cache_offer(jpeg_frame_t *frame){
+    if (frame->quality && frame->quality < CAPTURE_SHARE_QUALITY)
+        return;
+    // the stream encoder must not wait behind a /capture encode
+    if (xSemaphoreTake(cache_lock, 0) != pdTRUE)
+        return;
+    jpeg_frame_ref(frame);
+    replace(frame);
+    stats.shared++;
+    xSemaphoreGive(cache_lock);
+}
+
+bool capture_cache_not_modified(const char *etag){
+    char current[16] = {0,};
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    if (cached && (fresh(cached) || !motion_gate_frame_changed_since(cached_motion)))
+        snprintf(current, sizeof(current), "\"%u\"", cached->id);
+    xSemaphoreGive(cache_lock);
+    if (!current[0] || strcmp(etag, current))
+        return false;
+    stats.not_modified++;
+    return true;
+}
+
+void capture_cache_set_max_age(uint32_t ms){
+    max_age_ms = ms;
+}
+
+uint32_t capture_cache_max_age(){
+    return max_age_ms;
+}
+
+void capture_cache_get_stats(capture_cache_stats_t *out){
+    *out = stats;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "Arduino.h"
+#include "stream_broadcast.h"
+#include "motion_gate.h"
+
+// Last-frame cache behind /capture.
+//
+// /capture answers from the most recent full-frame JPEG while it is younger
+// than the max age, and only captures and encodes when it is stale. The stream
+// encoder offers every full frame it encodes at CAPTURE_SHARE_QUALITY or
+// better, the quality /capture encodes at itself, so a dashboard polling next
+// to a viewer streaming at q80 or more never triggers an encode of its own and
+// never gets a worse frame for it. Producing a frame happens under the cache
+// lock, so pollers arriving while it runs wait for and share that one encode.
+// Each frame's generation (its jpeg_frame_t id) is the ETag. If-None-Match is
+// checked before anything is captured: a poller that has the cached frame gets
+// a 304 while that frame is fresh or the motion gate saw nothing change since
+// it was cached, so a conditional poll of an idle scene costs no encode.
+
+#define CAPTURE_MAX_AGE_MS 250
+#define CAPTURE_SHARE_QUALITY 80
+
+typedef jpeg_frame_t *(*capture_producer_t)(void *arg);
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t not_modified;
+    uint32_t shared; //stream frames taken into the cache
+} capture_cache_stats_t;
+
+// Returns a fresh frame with a reference for the caller, running produce when
+// the cache is stale. NULL when producing failed.
+jpeg_frame_t *capture_cache_get(capture_producer_t produce, void *arg);
+void capture_cache_offer(jpeg_frame_t *frame);
+// true when etag (an If-None-Match value) still names the frame to serve
+bool capture_cache_not_modified(const char *etag);
+
+void capture_cache_set_max_age(uint32_t ms);
+uint32_t capture_cache_max_age();
+void capture_cache_get_stats(capture_cache_stats_t *out);
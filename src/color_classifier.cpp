@@ -0,0 +1,90 @@
+#include "color_classifier.h"
+
+static classifier_class_t classes[CLASSIFIER_CLASSES] = {
+    {true, {0x96, 0x96, 0x96}, {0xFF, 0xFF, 0xFF}},  //IR
+    {false, {0xA5, 0x00, 0x90}, {0xFF, 0x90, 0xFF}}, //purple
+    {false, {0x00, 0x90, 0x00}, {0x70, 0xFF, 0x90}}, //green
+    {false, {0x00, 0x00, 0x00}, {0xFF, 0xFF, 0xFF}},
+};
+static bool edited = true; //classes differ from the tables
+static classifier_stats_t stats = {1, 0, 0};
+static SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+
+uint8_t classifier_tables[4 * 256];
+
+static void build(const classifier_class_t *from){
+    uint8_t *t = classifier_tables;
+    memset(t, 0, 3 * 256);
+    uint8_t enabled = 0;
+    for (int k = 0; k < CLASSIFIER_CLASSES; ++k){
+        const classifier_class_t &c = from[k];
+        if (!c.enabled)
+            continue;
+        enabled |= 1 << k;
+        for (int ch = 0; ch < 3; ++ch){
+            for (int v = c.min[ch]; v <= c.max[ch]; ++v)
+                t[ch * 256 + v] |= 1 << k;
+        }
+    }
+    uint8_t *ids = t + 768;
+    for (int mask = 0; mask < 256; ++mask){
+        uint8_t id = 0;
+        for (int k = 0; k < 8 && !id; ++k){
+            if (mask & (1 << k))
+                id = k + 1;
+        }
+        ids[mask] = id;
+    }
+    stats.enabled = enabled;
+    stats.rebuilds++;
+}
+
+void classifier_begin_frame(){
+    if (!edited)
+        return;
+    classifier_class_t copy[CLASSIFIER_CLASSES];
+    xSemaphoreTake(lock, portMAX_DELAY);
+    memcpy(copy, classes, sizeof(copy));
+    edited = false;
+    xSemaphoreGive(lock);
+    build(copy);
+}
+
+bool classifier_select(int cls){
+    if (cls < 1 || cls > CLASSIFIER_CLASSES)
+        return false;
+    stats.selected = cls;
+    return true;
+}
+
+bool classifier_set(int field, int value){
+    if (field != CLASS_ON && (value < 0 || value > 255))
+        return false;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    classifier_class_t &c = classes[stats.selected - 1];
+    bool ok = true;
+    switch (field){
+        case CLASS_ON: c.enabled = value; break;
+        case CLASS_RMIN: c.min[0] = value; break;
+        case CLASS_RMAX: c.max[0] = value; break;
+        case CLASS_GMIN: c.min[1] = value; break;
+        case CLASS_GMAX: c.max[1] = value; break;
+        case CLASS_BMIN: c.min[2] = value; break;
+        case CLASS_BMAX: c.max[2] = value; break;
+        default: ok = false; break;
+    }
+    if (ok)
+        edited = true;
+    xSemaphoreGive(lock);
+    return ok;
+}
+
+void classifier_get(int cls, classifier_class_t *out){
+    xSemaphoreTake(lock, portMAX_DELAY);
+    *out = classes[cls - 1];
+    xSemaphoreGive(lock);
+}
+
+void classifier_get_stats(classifier_stats_t *out){
+    *out = stats;
+}
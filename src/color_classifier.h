@@ -0,0 +1,66 @@
+#pragma once
+#include "Arduino.h"
+
+// Marker classes by color, set at runtime instead of a fixed threshold.
+//
+// Every class is a box in RGB: a min and a max per channel. The boxes are
+// compiled into three 256 entry tables, one per channel, holding a bit for
+// each enabled class whose range contains that value, and a fourth table that
+// turns a class mask into the id of its lowest class. classify() is four byte
+// loads and two ANDs however many classes are on, and a pixel that fits
+// several classes takes the lowest id. YUV and grayscale frames have no color,
+// their luma stands in for all three channels.
+//
+// The classes are edited through /control: `class` selects the class that the
+// class_on and class_[rgb]{min,max} settings change. Edits only change the
+// class list; the detector rebuilds the tables from it in
+// classifier_begin_frame() before a frame, so the tables never change under a
+// running detector and a batch of edits costs one rebuild.
+//
+// Class 1 starts as the old fixed threshold, every channel above 0x95, which
+// is what the IR beacon saturates to. Classes 2 (purple) and 3 (green) come
+// with rough ranges and start off.
+
+#define CLASSIFIER_CLASSES 4
+
+enum {
+    CLASS_ON,
+    CLASS_RMIN,
+    CLASS_RMAX,
+    CLASS_GMIN,
+    CLASS_GMAX,
+    CLASS_BMIN,
+    CLASS_BMAX,
+};
+
+typedef struct {
+    bool enabled;
+    uint8_t min[3]; //R, G, B
+    uint8_t max[3];
+} classifier_class_t;
+
+typedef struct {
+    uint8_t selected; //class the class_* settings edit
+    uint8_t enabled;  //mask of the classes in the tables
+    uint32_t rebuilds;
+} classifier_stats_t;
+
+// R, G and B tables, then the mask to id table
+extern uint8_t classifier_tables[4 * 256];
+
+// the class id of a pixel, 0 for none
+static inline uint8_t classify(uint8_t R, uint8_t G, uint8_t B){
+    const uint8_t *t = classifier_tables;
+    return t[768 + (t[R] & t[256 + G] & t[512 + B])];
+}
+
+// rebuilds the tables when the classes were edited; called by whoever runs a
+// detector, before the frame and never during one
+void classifier_begin_frame();
+
+// false for an id out of 1..CLASSIFIER_CLASSES
+bool classifier_select(int cls);
+// changes a CLASS_* field of the selected class, false for a bad value
+bool classifier_set(int field, int value);
+void classifier_get(int cls, classifier_class_t *out);
+void classifier_get_stats(classifier_stats_t *out);
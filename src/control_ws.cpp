@@ -0,0 +1,260 @@
+#include "control_ws.h"
+#include "lwip/sockets.h"
+#include "mbedtls/sha1.h"
+#include "mbedtls/base64.h"
+
+#define WS_OP_TEXT 0x1
+#define WS_OP_CLOSE 0x8
+#define WS_OP_PING 0x9
+#define WS_OP_PONG 0xA
+#define WS_HEADROOM 4 //server frame header for payloads below 64 KB
+
+#define WS_CLOSE_UNSUPPORTED 1003
+#define WS_CLOSE_TOO_BIG 1009
+
+static const char *WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+static const char *WS_RESPONSE = "HTTP/1.1 101 Switching Protocols\r\n"
+                                 "Upgrade: websocket\r\n"
+                                 "Connection: Upgrade\r\n"
+                                 "Sec-WebSocket-Accept: %s\r\n\r\n";
+
+typedef struct {
+    int fd;
+    bool open; //handshake done
+    size_t len;
+    uint8_t buf[CONTROL_WS_MAX_MESSAGE + 16]; //request or frames received so far
+} ws_client_t;
+
+static ws_client_t clients[CONTROL_WS_MAX_CLIENTS];
+static control_ws_handler_t handler = NULL;
+static uint16_t port = 0;
+// only the control task touches it
+static uint8_t reply[WS_HEADROOM + CONTROL_WS_MAX_REPLY];
+
+static bool send_all(int fd, const uint8_t *buf, size_t len){
+    while (len){
+        int n = send(fd, buf, len, 0);
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+// data must have WS_HEADROOM writable bytes in front of it, the header goes
+// there so the frame leaves in a single send
+static bool send_frame(ws_client_t *c, uint8_t opcode, uint8_t *data, size_t len){
+    uint8_t *frame;
+    if (len < 126){
+        frame = data - 2;
+        frame[1] = len;
+    } else {
+        frame = data - 4;
+        frame[1] = 126;
+        frame[2] = len >> 8;
+        frame[3] = len & 0xFF;
+    }
+    frame[0] = 0x80 | opcode;
+    return send_all(c->fd, frame, data + len - frame);
+}
+
+static void send_close(ws_client_t *c, uint16_t code){
+    uint8_t close[WS_HEADROOM + 2];
+    close[WS_HEADROOM] = code >> 8;
+    close[WS_HEADROOM + 1] = code & 0xFF;
+    send_frame(c, WS_OP_CLOSE, close + WS_HEADROOM, 2);
+}
+
+static void drop(ws_client_t *c){
+    close(c->fd);
+    c->fd = -1;
+    c->open = false;
+    c->len = 0;
+}
+
+static void consume(ws_client_t *c, size_t n){
+    memmove(c->buf, c->buf + n, c->len - n);
+    c->len -= n;
+}
+
+// false when the client has to go
+static bool handshake(ws_client_t *c){
+    c->buf[c->len] = 0;
+    char *request = (char *)c->buf;
+    char *end = strstr(request, "\r\n\r\n");
+    if (!end)
+        return c->len < sizeof(c->buf) - 1;
+
+    char *key = strstr(request, "Sec-WebSocket-Key:");
+    if (!key)
+        key = strstr(request, "sec-websocket-key:");
+    if (!key)
+        return false;
+    key += strlen("Sec-WebSocket-Key:");
+    while (*key == ' ')
+        key++;
+    const size_t key_len = strcspn(key, "\r\n ");
+
+    char accept_src[64 + 36];
+    unsigned char sha[20];
+    unsigned char accept[32];
+    size_t accept_len = 0;
+    if (key_len > 64)
+        return false;
+    memcpy(accept_src, key, key_len);
+    memcpy(accept_src + key_len, WS_GUID, 36);
+    mbedtls_sha1_ret((const unsigned char *)accept_src, key_len + 36, sha);
+    mbedtls_base64_encode(accept, sizeof(accept), &accept_len, sha, sizeof(sha));
+    accept[accept_len] = 0;
+
+    char response[160];
+    const int n = snprintf(response, sizeof(response), WS_RESPONSE, accept);
+    if (!send_all(c->fd, (const uint8_t *)response, n))
+        return false;
+    consume(c, end + 4 - request);
+    c->open = true;
+    return true;
+}
+
+// handles every complete frame in the buffer, false when the client has to go
+static bool read_frames(ws_client_t *c){
+    while (c->len >= 2){
+        const uint8_t *b = c->buf;
+        const bool fin = b[0] & 0x80;
+        const uint8_t opcode = b[0] & 0x0F;
+        size_t len = b[1] & 0x7F;
+        size_t header = 2;
+        if (!(b[1] & 0x80))
+            return false; //clients must mask
+        if (len == 127){
+            send_close(c, WS_CLOSE_TOO_BIG);
+            return false;
+        }
+        if (len == 126){
+            if (c->len < 4)
+                return true;
+            len = (b[2] << 8) | b[3];
+            header = 4;
+        }
+        // room for the terminating NUL behind the payload
+        if (header + 4 + len >= sizeof(c->buf)){
+            send_close(c, WS_CLOSE_TOO_BIG);
+            return false;
+        }
+        if (c->len < header + 4 + len)
+            return true;
+
+        const uint8_t *mask = c->buf + header;
+        uint8_t *payload = c->buf + header + 4;
+        for (size_t i = 0; i < len; ++i)
+            payload[i] ^= mask[i & 3];
+
+        switch (opcode){
+            case WS_OP_TEXT: {
+                if (!fin){
+                    send_close(c, WS_CLOSE_UNSUPPORTED);
+                    return false;
+                }
+                payload[len] = 0;
+                const size_t n = handler((char *)payload, len, (char *)reply + WS_HEADROOM, CONTROL_WS_MAX_REPLY);
+                if (!send_frame(c, WS_OP_TEXT, reply + WS_HEADROOM, n))
+                    return false;
+                break;
+            }
+            case WS_OP_PING:
+                // the mask in front of the payload is the headroom
+                if (!send_frame(c, WS_OP_PONG, payload, len))
+                    return false;
+                break;
+            case WS_OP_PONG:
+                break;
+            case WS_OP_CLOSE:
+                send_frame(c, WS_OP_CLOSE, payload, len < 2 ? len : 2);
+                return false;
+            default:
+                send_close(c, WS_CLOSE_UNSUPPORTED);
+                return false;
+        }
+        consume(c, header + 4 + len);
+    }
+    return true;
+}
+
+static void accept_client(int listen_fd){
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+        return;
+    for (int i = 0; i < CONTROL_WS_MAX_CLIENTS; ++i){
+        ws_client_t *c = &clients[i];
+        if (c->fd >= 0)
+            continue;
+        const int one = 1;
+        const struct timeval timeout = {1, 0};
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        c->fd = fd;
+        c->open = false;
+        c->len = 0;
+        return;
+    }
+    close(fd);
+}
+
+static void control_ws_task(void *arg){
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    const int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(listen_fd, 2)){
+        Serial.println("control channel: could not listen");
+        if (listen_fd >= 0)
+            close(listen_fd);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    while (true){
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(listen_fd, &fds);
+        int maxfd = listen_fd;
+        for (int i = 0; i < CONTROL_WS_MAX_CLIENTS; ++i){
+            if (clients[i].fd >= 0){
+                FD_SET(clients[i].fd, &fds);
+                if (clients[i].fd > maxfd)
+                    maxfd = clients[i].fd;
+            }
+        }
+        if (select(maxfd + 1, &fds, NULL, NULL, NULL) <= 0)
+            continue;
+
+        for (int i = 0; i < CONTROL_WS_MAX_CLIENTS; ++i){
+            ws_client_t *c = &clients[i];
+            if (c->fd < 0 || !FD_ISSET(c->fd, &fds))
+                continue;
+            int n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len, 0);
+            if (n <= 0){
+                drop(c);
+                continue;
+            }
+            c->len += n;
+            if (!(c->open ? read_frames(c) : handshake(c)))
+                drop(c);
+        }
+        if (FD_ISSET(listen_fd, &fds))
+            accept_client(listen_fd);
+    }
+}
+
+void control_ws_start(uint16_t p, control_ws_handler_t h){
+    port = p;
+    handler = h;
+    for (int i = 0; i < CONTROL_WS_MAX_CLIENTS; ++i)
+        clients[i].fd = -1;
+    xTaskCreate(control_ws_task, "control_ws", 4096, NULL, 5, NULL);
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "Arduino.h"
+
+// Persistent WebSocket control channel.
+//
+// IDF 3.3's httpd has no WebSocket support, so this is a small server of its
+// own on the port after the stream server. One task selects over the listening
+// socket and at most CONTROL_WS_MAX_CLIENTS connections, does the RFC 6455
+// handshake and unmasks client frames. Every complete text message goes to the
+// handler, and what it writes is sent back as one text frame. Pings are
+// answered; fragmented and binary messages close the connection.
+
+#define CONTROL_WS_MAX_CLIENTS 2
+#define CONTROL_WS_MAX_MESSAGE 1024
+#define CONTROL_WS_MAX_REPLY 2048
+
+// message is NUL-terminated and may be modified, returns the reply length
+typedef size_t (*control_ws_handler_t)(char *message, size_t len, char *reply, size_t reply_len);
+
+void control_ws_start(uint16_t port, control_ws_handler_t handler);
@@ -1,11 +1,38 @@
 #pragma once
 #include "Arduino.h"
+#include "mem_budget.h"
+#include "frame_arena.h"
+#include "esp_camera.h"
+
+// bytes per pixel of a frame, 0 for JPEG and formats nothing here reads
+static inline uint32_t frame_bpp(pixformat_t format){
+    switch (format){
+        case PIXFORMAT_RGB888: return 3;
+        case PIXFORMAT_RGB565:
+        case PIXFORMAT_YUV422: return 2;
+        case PIXFORMAT_GRAYSCALE: return 1;
+        default: return 0;
+    }
+}
+
+// upper bound on tracked dots, dotsDetector() stops adding past this
+#define DOTS_MAX 11
+// largest framesize_t the raw frame buffers were allocated for, set in setup()
+extern int camera_max_framesize;
+
+// hits of one class closer than this (in both axes) belong to the same dot; the
+// legacy detector's default dilation (morph_dilate) bridges the same gaps
+#define SEARCH_RADIUS 3
+// a new dot whose center is this close to a dot of the previous frame keeps its track id
+#define TRACK_GATE 16
 
 struct Dot{
     uint32_t x;
     uint32_t y;
     uint32_t w;
     uint32_t h;
+    uint32_t id; //track id, kept while the dot is followed frame to frame, 0 until assigned
+    uint32_t cls; //marker class id, see color_classifier.h
 };
 
 extern "C" struct RGB {
@@ -14,38 +41,101 @@ extern "C" struct RGB {
     uint8_t B;
 };
 
+// One bit per pixel, coordinates like Map: x is 1-based, y is the row from 0.
+// Packed so a QQVGA mask is 2.4 KB and stays in internal DRAM (see
+// frame_arena_place()). Every row starts on a word, so rows can be worked on
+// 32 pixels at a time with morphology.h, where column x - 1 is the bit of
+// pixel x.
 struct Bitmap{
-    bool *bitmap;
+    uint32_t *bitmap;
     const size_t W;
     const size_t H;
+    const size_t S; //words per row
     const size_t L;
+    FrameArena &arena;
 
 
-    Bitmap(size_t w, size_t h, size_t s) : W(w), H(h), L(s){
-        // Serial.printf("in bitmap s = %ui \n", s);
-        bitmap = (bool*)ps_malloc(s * sizeof(bool));
+    Bitmap(size_t w, size_t h) : W(w), H(h), S((w + 31) / 32), L(h * S),
+            arena(frame_arena_place(L * sizeof(uint32_t), true)){
+        bitmap = (uint32_t*)arena.alloc(L * sizeof(uint32_t));
         if (!bitmap)
         {
             // Serial.printf("bad malloc  \n");
             ESP.restart();
         }
-        // Serial.printf("malloc bitmap \n");
-        for (int i = 0; i < s; ++i)
-            bitmap[i] = false;
-        // Serial.printf("init bitmap \n");
+        memset(bitmap, 0, L * sizeof(uint32_t));
     }
     ~Bitmap(){
-        free(bitmap);
+        arena.release(bitmap);
+    }
+    uint32_t *row(uint32_t y){
+        return bitmap + y * S;
     }
     bool getCell(uint32_t x, uint32_t y){
-        return bitmap[(y * W) + x - 1];
+        const uint32_t i = x - 1;
+        return (bitmap[y * S + (i >> 5)] >> (i & 31)) & 1;
     }
     void setCell(uint32_t x, uint32_t y, bool val){
-        bitmap[(y * W) + x - 1] = val;
+        const uint32_t i = x - 1;
+        if (val)
+            bitmap[y * S + (i >> 5)] |= 1u << (i & 31);
+        else
+            bitmap[y * S + (i >> 5)] &= ~(1u << (i & 31));
     }
 
 };
 
+// FIFO of points for detect_around(), one per run to visit. The ring lives in
+// internal DRAM; a blob whose frontier outgrows it spills into a PSRAM array
+// that is only allocated when that happens. Visit order does not change the
+// result.
+#define DETECT_RING 4096
+
+struct DetectQueue{
+    uint32_t *ring;
+    uint32_t *spill;
+    size_t head;
+    size_t tail;
+    size_t spilled;
+    const size_t spill_cap;
+    FrameArena &arena;
+
+    DetectQueue(size_t cells) : spill(NULL), head(0), tail(0), spilled(0), spill_cap(cells),
+            arena(frame_arena_place(DETECT_RING * sizeof(uint32_t), true)){
+        ring = (uint32_t*)arena.alloc(DETECT_RING * sizeof(uint32_t));
+        if (!ring)
+            ESP.restart();
+    }
+    ~DetectQueue(){
+        arena.release(ring);
+        frame_arena_psram.release(spill);
+    }
+    bool empty() const {
+        return head == tail && !spilled;
+    }
+    void clear(){
+        head = tail = spilled = 0;
+    }
+    void push(uint32_t x, uint32_t y){
+        const uint32_t v = (y << 16) | x;
+        if (tail - head < DETECT_RING){
+            ring[tail++ & (DETECT_RING - 1)] = v;
+            return;
+        }
+        if (!spill){
+            spill = (uint32_t*)frame_arena_psram.alloc(spill_cap * sizeof(uint32_t));
+            if (!spill)
+                ESP.restart();
+        }
+        spill[spilled++] = v;
+    }
+    void pop(uint32_t &x, uint32_t &y){
+        const uint32_t v = head != tail ? ring[head++ & (DETECT_RING - 1)] : spill[--spilled];
+        x = v & 0xFFFF;
+        y = v >> 16;
+    }
+};
+
 struct Vector2u{
     uint32_t x;
     uint32_t y;
@@ -0,0 +1,162 @@
+#include "dots_stream.h"
+#include "lwip/sockets.h"
+#include <errno.h>
+
+static const char* _DOTS_RESPONSE = "HTTP/1.1 200 OK\r\n"
+                                    "Content-Type: application/octet-stream\r\n"
+                                    "Transfer-Encoding: chunked\r\n"
+                                    "Access-Control-Allow-Origin: *\r\n"
+                                    "Cache-Control: no-cache\r\n"
+                                    "Connection: close\r\n\r\n";
+
+// chunk size line, record, chunk end
+#define DOTS_CHUNK_MAX (8 + sizeof(dots_record_t) + DOTS_MAX * sizeof(dots_record_dot_t) + 2)
+
+typedef struct {
+    httpd_handle_t hd;
+    int fd;
+    bool in_use;
+    bool closing;
+    uint8_t pending[DOTS_CHUNK_MAX]; //unsent tail of the last chunk
+    size_t pending_len;
+    uint32_t sent;
+    uint32_t dropped;
+} dots_client_t;
+
+static dots_client_t clients[DOTS_STREAM_MAX_CLIENTS];
+static SemaphoreHandle_t clients_lock = xSemaphoreCreateMutex();
+static volatile uint32_t active = 0;
+static uint32_t frame_counter = 0;
+
+static void close_client(dots_client_t *c){
+    c->closing = true;
+    active--;
+    httpd_sess_trigger_close(c->hd, c->fd);
+}
+
+// true when all of buf went out, the rest is kept in pending
+static bool send_some(dots_client_t *c, const uint8_t *buf, size_t len){
+    int n = send(c->fd, buf, len, MSG_DONTWAIT);
+    if (n < 0){
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            close_client(c);
+        n = 0;
+    }
+    if ((size_t)n < len){
+        memmove(c->pending, buf + n, len - n);
+        c->pending_len = len - n;
+        return false;
+    }
+    c->pending_len = 0;
+    return true;
+}
+
+void dots_stream_publish(const Dot *dots, size_t count, uint32_t width, uint32_t height, int64_t timestamp, uint32_t selected){
+    frame_counter++;
+    if (!active)
+        return;
+    if (count > DOTS_MAX)
+        count = DOTS_MAX;
+
+    uint8_t chunk[DOTS_CHUNK_MAX];
+    const size_t record_len = sizeof(dots_record_t) + count * sizeof(dots_record_dot_t);
+    size_t len = snprintf((char *)chunk, 8, "%x\r\n", record_len);
+    dots_record_t *record = (dots_record_t *)(chunk + len);
+    record->magic = DOTS_RECORD_MAGIC;
+    record->length = record_len;
+    record->frame = frame_counter;
+    record->timestamp = timestamp;
+    record->width = width;
+    record->height = height;
+    record->selected = selected;
+    record->count = count;
+    memset(record->reserved, 0, sizeof(record->reserved));
+    dots_record_dot_t *out = (dots_record_dot_t *)(record + 1);
+    for (size_t i = 0; i < count; ++i){
+        out[i].id = dots[i].id;
+        out[i].x = dots[i].x - 1;
+        out[i].y = dots[i].y;
+        out[i].w = dots[i].w;
+        out[i].h = dots[i].h;
+        out[i].cls = dots[i].cls;
+    }
+    len += record_len;
+    chunk[len++] = '\r';
+    chunk[len++] = '\n';
+
+    // loop() must not wait on httpd, skip the frame if a session is being torn down
+    if (xSemaphoreTake(clients_lock, 0) != pdTRUE)
+        return;
+    for (int i = 0; i < DOTS_STREAM_MAX_CLIENTS; ++i){
+        dots_client_t *c = &clients[i];
+        if (!c->in_use || c->closing)
+            continue;
+        if (c->pending_len){
+            uint8_t tail[DOTS_CHUNK_MAX];
+            memcpy(tail, c->pending, c->pending_len);
+            if (!send_some(c, tail, c->pending_len)){
+                c->dropped++;
+                continue;
+            }
+        }
+        if (send_some(c, chunk, len))
+            c->sent++;
+    }
+    xSemaphoreGive(clients_lock);
+}
+
+// httpd calls this when the session closes, before it closes the socket
+static void dots_client_free(void *ctx){
+    dots_client_t *c = (dots_client_t *)ctx;
+    xSemaphoreTake(clients_lock, portMAX_DELAY);
+    if (!c->closing)
+        active--;
+    c->in_use = false;
+    Serial.printf("Dots client %d closed, %u sent, %u dropped\n", c->fd, c->sent, c->dropped);
+    xSemaphoreGive(clients_lock);
+}
+
+esp_err_t dots_stream_subscribe(httpd_req_t *req){
+    const int fd = httpd_req_to_sockfd(req);
+    dots_client_t *c = NULL;
+
+    xSemaphoreTake(clients_lock, portMAX_DELAY);
+    for (int i = 0; i < DOTS_STREAM_MAX_CLIENTS; ++i){
+        if (!clients[i].in_use){
+            c = &clients[i];
+            break;
+        }
+    }
+    xSemaphoreGive(clients_lock);
+
+    if (!c){
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    const char *buf = _DOTS_RESPONSE;
+    size_t len = strlen(_DOTS_RESPONSE);
+    while (len){
+        int n = send(fd, buf, len, 0);
+        if (n <= 0)
+            return ESP_FAIL;
+        buf += n;
+        len -= n;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    xSemaphoreTake(clients_lock, portMAX_DELAY);
+    c->hd = req->handle;
+    c->fd = fd;
+    c->closing = false;
+    c->pending_len = 0;
+    c->sent = 0;
+    c->dropped = 0;
+    c->in_use = true;
+    active++;
+    xSemaphoreGive(clients_lock);
+
+    req->sess_ctx = c;
+    req->free_ctx = dots_client_free;
+    Serial.printf("Dots client %d connected\n", fd);
+    return ESP_OK;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "definations.h"
+#include "esp_http_server.h"
+
+// Results-only channel: /dots on the stream server.
+//
+// loop() publishes one binary record per detected frame right after the
+// detector, whether or not anyone watches /stream, and no JPEG is involved.
+// Every record travels as one HTTP/1.1 chunk of a never-ending chunked
+// response. Sends are non-blocking and made from loop() itself: a record that
+// does not fit the socket is kept and finished first on the next frame, and a
+// client that still has such a leftover skips the new record, so a stalled
+// consumer costs loop() nothing but a failed send.
+//
+// Record layout, little endian: dots_record_t followed by count
+// dots_record_dot_t. x and y are the top-left pixel of the dot, 0-based.
+
+#define DOTS_STREAM_MAX_CLIENTS 2 //the stream server shares its 7 sockets with /stream
+#define DOTS_RECORD_MAGIC 0xD075
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint16_t length;    //whole record in bytes
+    uint32_t frame;     //detector frame counter
+    uint64_t timestamp; //capture time, microseconds since boot
+    uint16_t width;
+    uint16_t height;
+    uint32_t selected;  //track id of the ROI target, 0 when none
+    uint8_t count;
+    uint8_t reserved[3];
+} dots_record_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t id;
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+    uint8_t cls;        //marker class id
+} dots_record_dot_t;
+
+esp_err_t dots_stream_subscribe(httpd_req_t *req);
+void dots_stream_publish(const Dot *dots, size_t count, uint32_t width, uint32_t height, int64_t timestamp, uint32_t selected);
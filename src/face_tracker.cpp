@@ -0,0 +1,197 @@
+#include "face_tracker.h"
+
+typedef struct {
+    box_t box;
+    landmark_t landmark;
+    fptp_t score;
+    float vx, vy; //pixels per microsecond
+    uint32_t id;
+    int face_id;
+} face_track_t;
+
+static face_track_t tracks[FACE_TRACK_MAX];
+static uint8_t track_count = 0;
+static uint32_t next_id = 1;
+static int64_t detected_at = 0;
+static uint8_t misses = 0;
+static uint8_t frames_since = FACE_EVERY_MAX;
+static uint8_t every_setting = 0;
+static face_tracker_stats_t stats = {1, 0, 0, 0, 0};
+
+static box_t out_box[FACE_TRACK_MAX];
+static landmark_t out_landmark[FACE_TRACK_MAX];
+static fptp_t out_score[FACE_TRACK_MAX];
+static box_array_t out = {out_box, out_score, out_landmark, 0};
+
+static inline float center_x(const box_t &b){
+    return (b.box_p[0] + b.box_p[2]) / 2;
+}
+
+static inline float center_y(const box_t &b){
+    return (b.box_p[1] + b.box_p[3]) / 2;
+}
+
+void face_tracker_set_every(int every){
+    every_setting = every < 0 ? 0 : every > FACE_EVERY_MAX ? FACE_EVERY_MAX : every;
+    if (every_setting)
+        stats.every = every_setting;
+}
+
+int face_tracker_every(){
+    return every_setting;
+}
+
+bool face_tracker_due(int64_t now){
+    if (++frames_since >= stats.every || misses)
+        return true;
+    if (!track_count)
+        return false;
+    const float dt = now - detected_at;
+    if (dt > FACE_TRACK_STALE_US)
+        return true;
+    for (int i = 0; i < track_count; ++i){
+        const face_track_t &t = tracks[i];
+        const float size = t.box.box_p[2] - t.box.box_p[0] + t.box.box_p[3] - t.box.box_p[1];
+        if (fabsf(t.vx * dt) + fabsf(t.vy * dt) > size / 8)
+            return true;
+    }
+    return false;
+}
+
+void face_tracker_detected(const box_array_t *boxes, int64_t now, uint32_t detect_us){
+    stats.detections++;
+    stats.detect_us = stats.detect_us ? (stats.detect_us * 3 + detect_us) / 4 : detect_us;
+    if (!every_setting){
+        const uint32_t every = (stats.detect_us + FACE_DETECT_BUDGET_US - 1) / FACE_DETECT_BUDGET_US;
+        stats.every = every < 1 ? 1 : every > FACE_EVERY_MAX ? FACE_EVERY_MAX : every;
+    }
+    frames_since = 0;
+
+    if (!boxes || boxes->len <= 0){
+        if (track_count && ++misses > FACE_TRACK_MISSES){
+            track_count = 0;
+            misses = 0;
+        }
+        stats.tracks = track_count;
+        return;
+    }
+    misses = 0;
+
+    face_track_t next[FACE_TRACK_MAX];
+    const int count = boxes->len < FACE_TRACK_MAX ? boxes->len : FACE_TRACK_MAX;
+    const float dt = now - detected_at;
+    uint32_t claimed = 0; //tracked boxes already matched
+    for (int i = 0; i < count; ++i){
+        face_track_t &n = next[i];
+        n.box = boxes->box[i];
+        n.landmark = boxes->landmark[i];
+        n.score = boxes->score[i];
+        n.vx = 0;
+        n.vy = 0;
+        n.face_id = 0;
+
+        // the nearest unclaimed tracked box whose center is within the new box's size
+        const float cx = center_x(n.box);
+        const float cy = center_y(n.box);
+        const float gate = fmaxf(n.box.box_p[2] - n.box.box_p[0], n.box.box_p[3] - n.box.box_p[1]);
+        int best = -1;
+        float best_dist = gate;
+        for (int j = 0; j < track_count; ++j){
+            if (claimed & (1u << j))
+                continue;
+            const float dist = fabsf(center_x(tracks[j].box) - cx) + fabsf(center_y(tracks[j].box) - cy);
+            if (dist < best_dist){
+                best = j;
+                best_dist = dist;
+            }
+        }
+        if (best >= 0 && dt > 0 && dt <= FACE_TRACK_STALE_US){
+            const face_track_t &o = tracks[best];
+            claimed |= 1u << best;
+            n.vx = (o.vx + (cx - center_x(o.box)) / dt) / 2;
+            n.vy = (o.vy + (cy - center_y(o.box)) / dt) / 2;
+            n.id = o.id;
+            n.face_id = o.face_id;
+        } else {
+            n.id = next_id++;
+        }
+    }
+    memcpy(tracks, next, count * sizeof(face_track_t));
+    track_count = count;
+    detected_at = now;
+    stats.tracks = track_count;
+}
+
+box_array_t *face_tracker_boxes(int64_t now){
+    const float dt = now - detected_at;
+    if (!track_count || dt > FACE_TRACK_STALE_US)
+        return NULL;
+    for (int i = 0; i < track_count; ++i){
+        const face_track_t &t = tracks[i];
+        const float dx = t.vx * dt;
+        const float dy = t.vy * dt;
+        for (int k = 0; k < 4; k += 2){
+            out_box[i].box_p[k] = t.box.box_p[k] + dx;
+            out_box[i].box_p[k + 1] = t.box.box_p[k + 1] + dy;
+        }
+        for (int k = 0; k < 10; k += 2){
+            out_landmark[i].landmark_p[k] = t.landmark.landmark_p[k] + dx;
+            out_landmark[i].landmark_p[k + 1] = t.landmark.landmark_p[k + 1] + dy;
+        }
+        out_score[i] = t.score;
+    }
+    out.len = track_count;
+    stats.propagated++;
+    return &out;
+}
+
+void face_tracker_hold(int64_t now){
+    // nothing moved since the last detection, so a stale track is still right
+    // where it was detected
+    const float dt = now - detected_at <= FACE_TRACK_STALE_US ? now - detected_at : 0;
+    for (int i = 0; i < track_count; ++i){
+        face_track_t &t = tracks[i];
+        const float dx = t.vx * dt;
+        const float dy = t.vy * dt;
+        for (int k = 0; k < 4; k += 2){
+            t.box.box_p[k] += dx;
+            t.box.box_p[k + 1] += dy;
+        }
+        for (int k = 0; k < 10; k += 2){
+            t.landmark.landmark_p[k] += dx;
+            t.landmark.landmark_p[k + 1] += dy;
+        }
+        t.vx = 0;
+        t.vy = 0;
+    }
+    detected_at = now;
+    frames_since = 0;
+}
+
+uint32_t face_tracker_id(int index){
+    return index < track_count ? tracks[index].id : 0;
+}
+
+int face_tracker_face_id(int index){
+    return index < track_count ? tracks[index].face_id : 0;
+}
+
+int face_tracker_index(uint32_t track){
+    for (int i = 0; i < track_count; ++i){
+        if (tracks[i].id == track)
+            return i;
+    }
+    return -1;
+}
+
+bool face_tracker_identify(uint32_t track, int face_id){
+    const int i = face_tracker_index(track);
+    if (i < 0)
+        return false;
+    tracks[i].face_id = face_id;
+    return true;
+}
+
+void face_tracker_get_stats(face_tracker_stats_t *out){
+    *out = stats;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "Arduino.h"
+#include "fd_forward.h"
+
+// Face boxes between detections.
+//
+// The MTMN cascade costs far more than a streamed frame, so the stream runs it
+// only every N frames and propagates the last boxes in between with a constant
+// velocity model on their centers: each detected box is matched to the nearest
+// tracked one and its velocity is the smoothed center shift per microsecond.
+// Landmarks move with their box. N adapts to the measured detection cost so
+// detection stays within FACE_DETECT_BUDGET_US per frame on average, or is
+// fixed through the face_every control. A box predicted to have moved more
+// than a quarter of its size since its detection, or a detection that found
+// nothing while faces were tracked, brings the next detection forward. Tracks
+// survive FACE_TRACK_MISSES empty detections before they are dropped, and are
+// not propagated further than FACE_TRACK_STALE_US from their detection. When
+// the motion gate sees a still scene a detection would find the same faces,
+// so the stream holds the tracks instead: they stop where they are and count
+// as detected now, and keep their boxes and ids for as long as nothing moves.
+//
+// Tracks keep their id across detections while they match, so an identity
+// found for a face later (see face_worker.h) lands on the right box.
+//
+// Only the stream encoder uses it, there is no locking.
+
+#define FACE_TRACK_MAX 4
+#define FACE_EVERY_MAX 8
+#define FACE_DETECT_BUDGET_US 40000
+#define FACE_TRACK_MISSES 2
+#define FACE_TRACK_STALE_US 1000000 //tracks older than this are not drawn
+
+typedef struct {
+    uint8_t every;      //frames per detection in use
+    uint32_t detect_us; //smoothed cost of one detection
+    uint32_t detections;
+    uint32_t propagated; //frames drawn from predicted boxes
+    uint8_t tracks;
+} face_tracker_stats_t;
+
+// 0 adapts N to the detection cost, 1 detects on every frame
+void face_tracker_set_every(int every);
+int face_tracker_every();
+
+// whether the frame at now needs a full detection
+bool face_tracker_due(int64_t now);
+// feeds a detection result (NULL when nothing was found), the boxes are copied
+void face_tracker_detected(const box_array_t *boxes, int64_t now, uint32_t detect_us);
+// the tracked boxes moved to now, NULL when nothing is tracked; owned by the
+// tracker and valid until the next call
+box_array_t *face_tracker_boxes(int64_t now);
+// stands in for a detection of an unchanged scene at now: the tracks stay at
+// their predicted boxes with no velocity
+void face_tracker_hold(int64_t now);
+
+// for box index of the last detection or propagation
+uint32_t face_tracker_id(int index);
+int face_tracker_face_id(int index);
+// -1 when the track is gone
+int face_tracker_index(uint32_t track);
+// false when the track is gone
+bool face_tracker_identify(uint32_t track, int face_id);
+
+void face_tracker_get_stats(face_tracker_stats_t *out);
@@ -0,0 +1,104 @@
+#include "face_worker.h"
+#include "esp_timer.h"
+#include "mem_budget.h"
+
+typedef struct {
+    dl_matrix3du_t *face;
+    uint32_t track;
+    int64_t timestamp;
+} face_slot_t;
+
+static portMUX_TYPE worker_mux = portMUX_INITIALIZER_UNLOCKED;
+static face_slot_t slots[3];
+static uint8_t writing = 0; //producer
+static uint8_t pending = 1; //mailbox
+static uint8_t working = 2; //worker
+static bool pending_fresh = false;
+
+static face_result_t result;
+static bool result_fresh = false;
+static face_worker_stats_t stats;
+
+static face_recognizer_t recognizer = NULL;
+static TaskHandle_t worker_task = NULL;
+
+static void face_worker_task(void *arg){
+    while (true){
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        portENTER_CRITICAL(&worker_mux);
+        const bool fresh = pending_fresh;
+        if (fresh){
+            const uint8_t t = working;
+            working = pending;
+            pending = t;
+            pending_fresh = false;
+        }
+        portEXIT_CRITICAL(&worker_mux);
+        if (!fresh)
+            continue;
+
+        const face_slot_t *slot = &slots[working];
+        face_result_t r;
+        memset(&r, 0, sizeof(r));
+        r.track = slot->track;
+        r.timestamp = slot->timestamp;
+        const int64_t start = esp_timer_get_time();
+        recognizer(slot->face, &r);
+
+        portENTER_CRITICAL(&worker_mux);
+        result = r;
+        result_fresh = true;
+        stats.recognized++;
+        stats.last_us = esp_timer_get_time() - start;
+        portEXIT_CRITICAL(&worker_mux);
+    }
+}
+
+bool face_worker_start(int width, int height, face_recognizer_t r){
+    MemScope scope(MEM_STAGE_FACE);
+    for (int i = 0; i < 3; ++i){
+        slots[i].face = dl_matrix3du_alloc(1, width, height, 3);
+        if (!slots[i].face){
+            Serial.println("face worker: could not allocate the face buffers");
+            return false;
+        }
+    }
+    recognizer = r;
+    return xTaskCreatePinnedToCore(face_worker_task, "face_worker", 8192, NULL, FACE_WORKER_PRIORITY, &worker_task, FACE_WORKER_CORE) == pdPASS;
+}
+
+dl_matrix3du_t *face_worker_buffer(){
+    return worker_task ? slots[writing].face : NULL;
+}
+
+void face_worker_post(uint32_t track, int64_t timestamp){
+    portENTER_CRITICAL(&worker_mux);
+    slots[writing].track = track;
+    slots[writing].timestamp = timestamp;
+    const uint8_t t = pending;
+    pending = writing;
+    writing = t;
+    if (pending_fresh)
+        stats.replaced++;
+    pending_fresh = true;
+    stats.posted++;
+    portEXIT_CRITICAL(&worker_mux);
+    xTaskNotifyGive(worker_task);
+}
+
+bool face_worker_result(face_result_t *out){
+    portENTER_CRITICAL(&worker_mux);
+    const bool fresh = result_fresh;
+    if (fresh){
+        *out = result;
+        result_fresh = false;
+    }
+    portEXIT_CRITICAL(&worker_mux);
+    return fresh;
+}
+
+void face_worker_get_stats(face_worker_stats_t *out){
+    portENTER_CRITICAL(&worker_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&worker_mux);
+}
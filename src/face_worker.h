@@ -0,0 +1,51 @@
+#pragma once
+#include "Arduino.h"
+#include "dl_lib_matrix3d.h"
+
+// Face recognition off the stream path.
+//
+// align_face() stays in the stream encoder, which owns the frame; recognizing
+// or enrolling the aligned face runs in a worker task below the encoder. They
+// share three aligned-face buffers: the encoder aligns into its own, posting
+// swaps it with the mailbox, and the worker swaps the mailbox with the one it
+// works on. The mailbox holds one face, a newer post replaces a face the worker
+// has not taken yet, so neither side ever waits or allocates. Each face carries
+// the tracker id of its box, and the result goes back tagged with it, so the
+// encoder attaches it to that track and draws it on the frames that follow.
+//
+// The worker shares core 0 with the encoder, one priority below it. Core 1
+// belongs to loop(), whose task is priority 1 and only waits for the camera,
+// so a worker there at the same priority would take time slices from
+// detection. On core 0 recognition only
+// runs while the encoder waits for a frame, and a slow recognition delays
+// the labels, never the stream or the detector.
+
+#define FACE_WORKER_CORE 0
+#define FACE_WORKER_PRIORITY 1 //the stream encoder runs at 2
+
+typedef struct {
+    uint32_t track;
+    int32_t face_id;    //matched id, -1 when nothing matched
+    uint32_t color;
+    char label[32];     //empty when there is nothing to draw
+    int64_t timestamp;  //of the frame the face came from
+} face_result_t;
+
+typedef struct {
+    uint32_t posted;
+    uint32_t replaced;  //faces dropped from the mailbox for a newer one
+    uint32_t recognized;
+    uint32_t last_us;
+} face_worker_stats_t;
+
+// fills result for an aligned face, runs on the worker task
+typedef void (*face_recognizer_t)(dl_matrix3du_t *face, face_result_t *result);
+
+bool face_worker_start(int width, int height, face_recognizer_t recognizer);
+// the buffer the producer aligns into, valid until the next post
+dl_matrix3du_t *face_worker_buffer();
+void face_worker_post(uint32_t track, int64_t timestamp);
+// true once for every new result
+bool face_worker_result(face_result_t *out);
+
+void face_worker_get_stats(face_worker_stats_t *out);
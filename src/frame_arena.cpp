@@ -0,0 +1,69 @@
+#include "frame_arena.h"
+
+#define ARENA_ALIGN 8
+#define ARENA_GRANULE 4096
+
+FrameArena frame_arena_dram("dram", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT, 64 * 1024);
+FrameArena frame_arena_psram("psram", MALLOC_CAP_SPIRAM, 3 * 1024 * 1024);
+
+FrameArena::FrameArena(const char *n, uint32_t c, size_t l)
+    : name(n), caps(c), limit(l), base(NULL), capacity(0), used(0), wanted(0),
+      high_water(0), overflows(0), resets(0){
+}
+
+void *FrameArena::alloc(size_t size){
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    wanted += size;
+    if (used + size <= capacity){
+        void *ptr = base + used;
+        used += size;
+        return ptr;
+    }
+    overflows++;
+    mem_budget_rewarm(); //the frame outgrew the arena, reset() grows it
+    return mem_budget_malloc(MEM_STAGE_DETECT, size, caps);
+}
+
+void FrameArena::release(void *ptr){
+    if (ptr && !owns(ptr))
+        mem_budget_free(ptr);
+}
+
+void FrameArena::reset(){
+    if (wanted > high_water)
+        high_water = wanted;
+    if (wanted > capacity && capacity < limit){
+        size_t grow = (wanted + ARENA_GRANULE - 1) & ~(ARENA_GRANULE - 1);
+        if (grow > limit)
+            grow = limit;
+        mem_budget_free(base);
+        mem_budget_rewarm();
+        base = (uint8_t *)mem_budget_malloc(MEM_STAGE_DETECT, grow, caps);
+        capacity = base ? grow : 0;
+        if (!base)
+            Serial.printf("arena %s: could not grow to %u bytes\n", name, grow);
+    }
+    used = 0;
+    wanted = 0;
+    resets++;
+}
+
+FrameArena &frame_arena_place(size_t size, bool hot){
+    if (hot && frame_arena_dram.wanted + size <= frame_arena_dram.limit)
+        return frame_arena_dram;
+    return frame_arena_psram;
+}
+
+void frame_arena_write_json(JsonWriter &w){
+    const FrameArena *arenas[] = {&frame_arena_dram, &frame_arena_psram};
+    for (int i = 0; i < 2; ++i){
+        const FrameArena *a = arenas[i];
+        w.beginObject(a->name);
+        w.field("capacity", a->capacity);
+        w.field("used", a->used);
+        w.field("high_water", a->high_water);
+        w.field("overflows", a->overflows);
+        w.field("resets", a->resets);
+        w.endObject();
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "Arduino.h"
+#include "mem_budget.h"
+
+// Bump-pointer arena for memory that lives for one detector frame.
+//
+// alloc() only moves a pointer and reset() rewinds it, so a frame that fits
+// does no heap operations at all. Requests that do not fit fall back to the
+// heap, are counted as overflows and make the next reset() grow the arena to
+// the size the frame actually needed (up to limit), so the steady state goes
+// back to zero heap traffic after a resolution change.
+struct FrameArena{
+    const char *name;
+    const uint32_t caps;
+    const size_t limit;
+    uint8_t *base;
+    size_t capacity;
+    size_t used;
+    size_t wanted;
+    size_t high_water;
+    uint32_t overflows;
+    uint32_t resets;
+
+    FrameArena(const char *n, uint32_t c, size_t l);
+
+    void *alloc(size_t size);
+    void release(void *ptr);
+    void reset();
+
+    bool owns(const void *ptr) const {
+        return (const uint8_t *)ptr >= base && (const uint8_t *)ptr < base + capacity;
+    }
+};
+
+extern FrameArena frame_arena_dram;
+extern FrameArena frame_arena_psram;
+
+// Placement policy. Small, hot, randomly accessed per-frame state (packed
+// masks, label tables, queues) goes to internal DRAM as long as the frame stays
+// inside the DRAM arena's limit; bulk data and anything that does not fit goes
+// to PSRAM, which is slower for random access and pays for the
+// -mfix-esp32-psram-cache-issue workaround on every load and store.
+FrameArena &frame_arena_place(size_t size, bool hot);
+
+// one object per arena, written into the object w is in
+void frame_arena_write_json(JsonWriter &w);
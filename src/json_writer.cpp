@@ -0,0 +1,146 @@
+#include "json_writer.h"
+#include "esp_http_server.h"
+
+JsonWriter::JsonWriter(char *buf, size_t cap, flush_t flush, void *arg)
+    : buf(buf), cap(cap), len(0), flush(flush), arg(arg), failed(false), depth(0), has_items(0){
+}
+
+void JsonWriter::put(char c){
+    if (len == cap){
+        if (failed || !flush || !flush(arg, buf, len)){
+            failed = true;
+            return;
+        }
+        len = 0;
+    }
+    buf[len++] = c;
+}
+
+void JsonWriter::put(const char *s, size_t n){
+    while (n && !failed){
+        if (len == cap){
+            put(*s++);
+            --n;
+            continue;
+        }
+        size_t chunk = cap - len < n ? cap - len : n;
+        memcpy(buf + len, s, chunk);
+        len += chunk;
+        s += chunk;
+        n -= chunk;
+    }
+}
+
+void JsonWriter::string(const char *s){
+    static const char hex[] = "0123456789abcdef";
+    put('"');
+    for (; *s; ++s){
+        const unsigned char c = *s;
+        if (c == '"' || c == '\\'){
+            put('\\');
+            put(c);
+        } else if (c < 0x20){
+            put("\\u00", 4);
+            put(hex[c >> 4]);
+            put(hex[c & 0xF]);
+        } else {
+            put(c);
+        }
+    }
+    put('"');
+}
+
+void JsonWriter::key(const char *k){
+    if (has_items & (1u << depth))
+        put(',');
+    has_items |= 1u << depth;
+    if (k){
+        string(k);
+        put(':');
+    }
+}
+
+void JsonWriter::digits(uint64_t value, bool negative){
+    char tmp[21];
+    size_t n = sizeof(tmp);
+    do {
+        tmp[--n] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    if (negative)
+        tmp[--n] = '-';
+    put(tmp + n, sizeof(tmp) - n);
+}
+
+void JsonWriter::beginObject(const char *k){
+    key(k);
+    put('{');
+    if (depth + 1 < JSON_MAX_DEPTH){
+        depth++;
+        has_items &= ~(1u << depth);
+    } else {
+        failed = true;
+    }
+}
+
+void JsonWriter::endObject(){
+    put('}');
+    if (depth)
+        depth--;
+}
+
+void JsonWriter::beginArray(const char *k){
+    key(k);
+    put('[');
+    if (depth + 1 < JSON_MAX_DEPTH){
+        depth++;
+        has_items &= ~(1u << depth);
+    } else {
+        failed = true;
+    }
+}
+
+void JsonWriter::endArray(){
+    put(']');
+    if (depth)
+        depth--;
+}
+
+void JsonWriter::field(const char *k, int32_t value){
+    key(k);
+    digits(value < 0 ? -(int64_t)value : value, value < 0);
+}
+
+void JsonWriter::field(const char *k, uint32_t value){
+    key(k);
+    digits(value, false);
+}
+
+void JsonWriter::field(const char *k, int64_t value){
+    key(k);
+    // the magnitude of INT64_MIN does not fit in int64_t
+    digits(value < 0 ? 0 - (uint64_t)value : (uint64_t)value, value < 0);
+}
+
+void JsonWriter::field(const char *k, const char *value){
+    key(k);
+    string(value);
+}
+
+void JsonWriter::raw(const char *k, const char *value, size_t n){
+    key(k);
+    put(value, n);
+}
+
+bool JsonWriter::finish(){
+    if (!failed && flush && len){
+        if (!flush(arg, buf, len))
+            failed = true;
+        len = 0;
+    }
+    return !failed;
+}
+
+bool json_httpd_chunk(void *req, const char *data, size_t len){
+    return httpd_resp_send_chunk((httpd_req_t *)req, data, len) == ESP_OK;
+}
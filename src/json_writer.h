@@ -0,0 +1,57 @@
+#pragma once
+#include "Arduino.h"
+
+// Bounded streaming JSON writer.
+//
+// Writes into a caller-owned buffer, usually on the stack. With a flush
+// callback a full buffer is handed on (e.g. as an HTTP chunk) and reused, so
+// any amount of JSON goes out through a few hundred bytes; without one the
+// output stops at the end of the buffer and ok() turns false. Commas are
+// placed automatically, integers are formatted by hand, nothing allocates and
+// no printf is involved.
+
+#define JSON_MAX_DEPTH 16
+#define JSON_CHUNK_SIZE 256 //stack buffer of a chunked JSON response
+
+struct JsonWriter{
+    typedef bool (*flush_t)(void *arg, const char *data, size_t len);
+
+    JsonWriter(char *buf, size_t cap, flush_t flush = NULL, void *arg = NULL);
+
+    void beginObject(const char *key = NULL);
+    void endObject();
+    void beginArray(const char *key = NULL);
+    void endArray();
+
+    // a NULL key writes an array element
+    void field(const char *key, int32_t value);
+    void field(const char *key, uint32_t value);
+    void field(const char *key, int64_t value);
+    void field(const char *key, const char *value);
+    // value is written as is, it must be valid JSON
+    void raw(const char *key, const char *value, size_t len);
+
+    // flushes what is left, true when everything was written
+    bool finish();
+    bool ok() const { return !failed; }
+    size_t size() const { return len; } //bytes in buf, without a flush callback the whole output
+
+private:
+    char *buf;
+    size_t cap;
+    size_t len;
+    flush_t flush;
+    void *arg;
+    bool failed;
+    uint8_t depth;
+    uint32_t has_items; //bit n: the container at depth n already has an item
+
+    void put(char c);
+    void put(const char *s, size_t n);
+    void string(const char *s);
+    void key(const char *k);
+    void digits(uint64_t value, bool negative);
+};
+
+// flush callback sending every buffer as a chunk of an httpd response
+bool json_httpd_chunk(void *req, const char *data, size_t len);
@@ -2,6 +2,11 @@
 #include <WiFi.h>
 #include <Servo.h>
 #include "definations.h"
+#include "stream_roi.h"
+#include "dots_stream.h"
+#include "motion_gate.h"
+#include "background_model.h"
+#include "esp_timer.h"
 
 
 
@@ -20,6 +25,18 @@
 #define MSGL 0b11010101
 
 #include "camera_pins.h"
+
+// Raw frame buffers are allocated for this size at init, so it is also the
+// largest framesize /control can switch to later. The tiled detector handles
+// large frames; RGB888 fits two SVGA buffers in PSRAM, grayscale goes to UXGA.
+#ifndef CAMERA_FRAMESIZE
+#define CAMERA_FRAMESIZE FRAMESIZE_QQVGA
+#endif
+#ifndef CAMERA_PIXFORMAT
+#define CAMERA_PIXFORMAT PIXFORMAT_RGB888
+#endif
+
+int camera_max_framesize = CAMERA_FRAMESIZE;
 HardwareSerial ServoSerial(115200);
 
 const char* ssid = "Target";
@@ -29,9 +46,12 @@ const char* password = "09876543";
 
 int pos = 0;
 int pos2 = 0;
+std::vector<Dot> loop_dots;
 
 void startCameraServer();
 void irdetector(camera_fb_t * fb, std::vector<Dot> &detectedDots);
+void irdetector_draw(camera_fb_t * fb, const std::vector<Dot> &detectedDots);
+bool stream_offer_frame(camera_fb_t *fb);
 
 void setup() {
   // uint32_t errors = 0;
@@ -53,6 +73,7 @@ void setup() {
   // }
   // free(arr);
 
+  loop_dots.reserve(DOTS_MAX);
   Serial.begin(115200);
   Serial.setDebugOutput(true);
   Serial.println();
@@ -79,12 +100,13 @@ void setup() {
   config.pin_pwdn = PWDN_GPIO_NUM;
   config.pin_reset = RESET_GPIO_NUM;
   config.xclk_freq_hz = 20000000;
-  config.pixel_format = PIXFORMAT_RGB888;
+  config.pixel_format = CAMERA_PIXFORMAT;
   //init with high specs to pre-allocate larger buffers
   if(psramFound()){
-    config.frame_size = FRAMESIZE_QQVGA;
+    config.frame_size = CAMERA_FRAMESIZE;
     // config.jpeg_quality = 10;
-    config.fb_count = 1;
+    // one buffer for the detector, one the stream encoder can hold
+    config.fb_count = 2;
   } else {
     config.frame_size = FRAMESIZE_QQVGA;
     // config.jpeg_quality = 12;
@@ -154,11 +176,21 @@ void loop() {
   // put your main code here, to run repeatedly:
   camera_fb_t * fb = NULL;
   int64_t fr_start = millis();
-  char* buf;
+  mem_frame_t mem_frame;
+  mem_budget_frame_begin(&mem_frame);
   fb = esp_camera_fb_get();
-  buf = (char*)malloc(fb->len);
-  std::vector<Dot> dots;
+  if (!fb) {
+    return;
+  }
+  const int64_t captured = esp_timer_get_time();
+  motion_gate_update(fb);
+  std::vector<Dot> &dots = loop_dots;
+  dots.clear();
   irdetector(fb, dots); 
+  stream_roi_track(dots.data(), dots.size(), fb->width, fb->height);
+  dots_stream_publish(dots.data(), dots.size(), fb->width, fb->height, captured, stream_roi_selected());
+  background_update(fb, dots.data(), dots.size(), stream_roi_selected());
+  irdetector_draw(fb, dots);
   
   int averx = 0;
   int avery = 0;
@@ -171,7 +203,10 @@ void loop() {
     avery = (avery / dots.size() - fb->height / 2) * -1;
   }
   
-  esp_camera_fb_return(fb);
+  if (!stream_offer_frame(fb)) {
+    esp_camera_fb_return(fb);
+  }
+  mem_budget_frame_end(&mem_frame, "loop");
   int64_t fr_end = millis();
   // Serial.printf("%ums (%.1ffps) cpuf = %u\n", (uint32_t)(fr_end - fr_start), 1000.0 / (uint32_t)(fr_end - fr_start), ESP.getCpuFreqMHz());
   // delay(10000);
@@ -0,0 +1,112 @@
+#include "matrix_cache.h"
+#include "mem_budget.h"
+
+typedef struct {
+    dl_matrix3du_t *matrix;
+    bool busy;
+} matrix_slot_t;
+
+static portMUX_TYPE cache_mux = portMUX_INITIALIZER_UNLOCKED;
+static matrix_slot_t slots[MATRIX_CACHE_SLOTS];
+static matrix_cache_stats_t stats;
+
+static bool fits(const dl_matrix3du_t *m, int w, int h, int c){
+    return m && m->w == w && m->h == h && m->c == c;
+}
+
+static uint32_t matrix_bytes(const dl_matrix3du_t *m){
+    return m ? m->n * m->w * m->h * m->c : 0;
+}
+
+static dl_matrix3du_t *alloc_matrix(int w, int h, int c){
+    MemScope scope(MEM_STAGE_FACE);
+    return dl_matrix3du_alloc(1, w, h, c);
+}
+
+static void free_matrix(dl_matrix3du_t *m){
+    MemScope scope(MEM_STAGE_FACE);
+    dl_matrix3du_free(m);
+}
+
+dl_matrix3du_t *matrix_cache_borrow(int w, int h, int c){
+    matrix_slot_t *slot = NULL;
+
+    // an idle slot of the right size, otherwise an empty one, otherwise any
+    // idle one to reallocate
+    portENTER_CRITICAL(&cache_mux);
+    for (int i = 0; i < MATRIX_CACHE_SLOTS; ++i){
+        matrix_slot_t *s = &slots[i];
+        if (s->busy)
+            continue;
+        if (fits(s->matrix, w, h, c)){
+            slot = s;
+            break;
+        }
+        if (!slot || (slot->matrix && !s->matrix))
+            slot = s;
+    }
+    if (slot){
+        slot->busy = true;
+        if (fits(slot->matrix, w, h, c))
+            stats.hits++;
+    } else {
+        stats.overflow++;
+    }
+    portEXIT_CRITICAL(&cache_mux);
+
+    if (!slot)
+        return alloc_matrix(w, h, c);
+    if (fits(slot->matrix, w, h, c))
+        return slot->matrix;
+
+    // the slot is ours, (re)allocate outside the critical section
+    if (slot->matrix){
+        stats.bytes -= matrix_bytes(slot->matrix);
+        free_matrix(slot->matrix);
+    }
+    slot->matrix = alloc_matrix(w, h, c);
+    stats.allocs++;
+    if (!slot->matrix){
+        slot->busy = false;
+        return NULL;
+    }
+    stats.bytes += matrix_bytes(slot->matrix);
+    return slot->matrix;
+}
+
+void matrix_cache_return(dl_matrix3du_t *matrix){
+    if (!matrix)
+        return;
+    portENTER_CRITICAL(&cache_mux);
+    for (int i = 0; i < MATRIX_CACHE_SLOTS; ++i){
+        if (slots[i].matrix == matrix){
+            slots[i].busy = false;
+            portEXIT_CRITICAL(&cache_mux);
+            return;
+        }
+    }
+    portEXIT_CRITICAL(&cache_mux);
+    free_matrix(matrix);
+}
+
+void matrix_cache_trim(){
+    for (int i = 0; i < MATRIX_CACHE_SLOTS; ++i){
+        dl_matrix3du_t *m = NULL;
+        portENTER_CRITICAL(&cache_mux);
+        if (!slots[i].busy){
+            m = slots[i].matrix;
+            slots[i].matrix = NULL;
+        }
+        portEXIT_CRITICAL(&cache_mux);
+        if (m){
+            stats.bytes -= matrix_bytes(m);
+            free_matrix(m);
+        }
+    }
+}
+
+void matrix_cache_get_stats(matrix_cache_stats_t *out){
+    portENTER_CRITICAL(&cache_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&cache_mux);
+}
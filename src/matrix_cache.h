@@ -0,0 +1,30 @@
+#pragma once
+#include "Arduino.h"
+#include "dl_lib_matrix3d.h"
+
+// Persistent matrices for the face path.
+//
+// Converting a frame for face_detect needs a width x height x 3 matrix and
+// recognition needs an aligned face, and allocating both per frame churns
+// PSRAM for every streamed frame. The face path borrows them from a few slots
+// instead, keyed by their dimensions, and gives them back when the frame is
+// done. A slot is only reallocated when a borrower asks for other dimensions,
+// i.e. when the framesize changes. When every slot is busy the matrix is
+// allocated for that one borrower and freed again on return.
+
+#define MATRIX_CACHE_SLOTS 3 //stream frame, /capture frame, aligned face
+
+typedef struct {
+    uint32_t hits;
+    uint32_t allocs;   //slot (re)allocations
+    uint32_t overflow; //borrows with every slot busy
+    uint32_t bytes;    //held by the slots
+} matrix_cache_stats_t;
+
+// NULL when the allocation failed
+dl_matrix3du_t *matrix_cache_borrow(int w, int h, int c);
+void matrix_cache_return(dl_matrix3du_t *matrix);
+// frees the matrices of idle slots, e.g. when face detection is switched off
+void matrix_cache_trim();
+
+void matrix_cache_get_stats(matrix_cache_stats_t *out);
@@ -0,0 +1,209 @@
+#include "mem_budget.h"
+#include "soc/soc.h"
+
+#define MEM_TAG_MAGIC 0xB0D6
+
+typedef struct {
+    uint32_t size;
+    uint8_t stage;
+    uint8_t region;
+    uint16_t magic;
+} mem_tag_t;
+
+static const char *stage_names[MEM_STAGE_MAX] = {
+    "detect", "face", "encode", "stream", "http"
+};
+
+typedef struct {
+    TaskHandle_t task;
+    uint32_t allocs;
+    uint32_t frames;
+    uint32_t warm_until; //frames numbered below this may allocate
+} pipeline_t;
+
+static mem_counter_t counters[MEM_STAGE_MAX][MEM_REGION_MAX];
+static pipeline_t pipelines[MEM_BUDGET_PIPELINES];
+static uint32_t steady_violations = 0;
+static portMUX_TYPE mem_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static mem_region_t region_of(const void *ptr){
+    const uint32_t addr = (uint32_t)ptr;
+    if (addr >= SOC_EXTRAM_DATA_LOW && addr < SOC_EXTRAM_DATA_HIGH)
+        return MEM_REGION_PSRAM;
+    return MEM_REGION_INTERNAL;
+}
+
+// the pipeline of task, NULL for a task that does not bracket frames; called
+// with mem_mux held
+static pipeline_t *pipeline_of(TaskHandle_t task){
+    for (int i = 0; i < MEM_BUDGET_PIPELINES; ++i){
+        if (pipelines[i].task == task)
+            return &pipelines[i];
+    }
+    return NULL;
+}
+
+static void account(mem_stage_t stage, mem_region_t region, int32_t bytes, bool alloc){
+    mem_counter_t *c = &counters[stage][region];
+    const TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    portENTER_CRITICAL(&mem_mux);
+    if (alloc){
+        c->allocs++;
+        c->live_count++;
+        if (stage != MEM_STAGE_HTTP){
+            pipeline_t *p = pipeline_of(task);
+            if (p)
+                p->allocs++;
+        }
+    } else {
+        c->frees++;
+        if (c->live_count)
+            c->live_count--;
+    }
+    c->live_bytes += bytes;
+    if (c->live_bytes > c->peak_bytes)
+        c->peak_bytes = c->live_bytes;
+    portEXIT_CRITICAL(&mem_mux);
+}
+
+void *mem_budget_malloc(mem_stage_t stage, size_t size, uint32_t caps){
+    mem_tag_t *tag = (mem_tag_t *)heap_caps_malloc(size + sizeof(mem_tag_t), caps);
+    if (!tag)
+        return NULL;
+    tag->size = size;
+    tag->stage = stage;
+    tag->region = region_of(tag);
+    tag->magic = MEM_TAG_MAGIC;
+    account(stage, (mem_region_t)tag->region, size, true);
+    return tag + 1;
+}
+
+void mem_budget_free(void *ptr){
+    if (!ptr)
+        return;
+    mem_tag_t *tag = (mem_tag_t *)ptr - 1;
+    if (tag->magic != MEM_TAG_MAGIC){
+        log_e("mem_budget_free on untracked pointer %p", ptr);
+        abort();
+    }
+    tag->magic = 0;
+    account((mem_stage_t)tag->stage, (mem_region_t)tag->region, -(int32_t)tag->size, false);
+    heap_caps_free(tag);
+}
+
+MemScope::MemScope(mem_stage_t s) : stage(s){
+    internal_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+}
+
+MemScope::~MemScope(){
+    const int32_t internal_delta = (int32_t)internal_free - (int32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    const int32_t psram_delta = (int32_t)psram_free - (int32_t)heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    // a scope always wraps a call that allocates, so it is one event even when
+    // the buffer was released before the call returned
+    if (internal_delta >= 0 && psram_delta >= 0){
+        account(stage, psram_delta > internal_delta ? MEM_REGION_PSRAM : MEM_REGION_INTERNAL,
+                psram_delta > internal_delta ? psram_delta : internal_delta, true);
+    } else {
+        account(stage, psram_delta < internal_delta ? MEM_REGION_PSRAM : MEM_REGION_INTERNAL,
+                psram_delta < internal_delta ? psram_delta : internal_delta, false);
+    }
+}
+
+void mem_budget_frame_begin(mem_frame_t *frame){
+    const TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    portENTER_CRITICAL(&mem_mux);
+    pipeline_t *p = pipeline_of(task);
+    if (!p){
+        p = pipeline_of(NULL);
+        if (p)
+            p->task = task;
+    }
+    if (p){
+        frame->pipeline = p - pipelines;
+        frame->allocs = p->allocs;
+        frame->number = p->frames++;
+    } else {
+        frame->pipeline = MEM_BUDGET_PIPELINES;
+        frame->allocs = 0;
+        frame->number = 0;
+    }
+    portEXIT_CRITICAL(&mem_mux);
+}
+
+void mem_budget_frame_end(mem_frame_t *frame, const char *who){
+    if (frame->pipeline >= MEM_BUDGET_PIPELINES)
+        return;
+    const uint32_t allocated = pipelines[frame->pipeline].allocs - frame->allocs;
+    if (!allocated || frame->number < MEM_BUDGET_WARMUP_FRAMES || frame->number < pipelines[frame->pipeline].warm_until)
+        return;
+    steady_violations++;
+#if MEM_BUDGET_STRICT
+    Serial.printf("MEM: %s frame %u made %u heap allocations in steady state\n", who, frame->number, allocated);
+    for (int s = 0; s < MEM_STAGE_MAX; ++s){
+        for (int r = 0; r < MEM_REGION_MAX; ++r){
+            const mem_counter_t *c = &counters[s][r];
+            Serial.printf("MEM: %-8s %s allocs %u live %dB peak %dB\n", stage_names[s],
+                          r == MEM_REGION_PSRAM ? "psram" : "dram ", c->allocs, c->live_bytes, c->peak_bytes);
+        }
+    }
+    abort();
+#endif
+}
+
+void mem_budget_rewarm(){
+    portENTER_CRITICAL(&mem_mux);
+    for (int i = 0; i < MEM_BUDGET_PIPELINES; ++i)
+        pipelines[i].warm_until = pipelines[i].frames + MEM_BUDGET_WARMUP_FRAMES;
+    portEXIT_CRITICAL(&mem_mux);
+}
+
+void mem_budget_get(mem_stage_t stage, mem_region_t region, mem_counter_t *out){
+    portENTER_CRITICAL(&mem_mux);
+    *out = counters[stage][region];
+    portEXIT_CRITICAL(&mem_mux);
+}
+
+const char *mem_budget_stage_name(mem_stage_t stage){
+    return stage_names[stage];
+}
+
+void mem_budget_write_json(JsonWriter &w){
+    static const uint32_t region_caps[MEM_REGION_MAX] = {MALLOC_CAP_INTERNAL, MALLOC_CAP_SPIRAM};
+    static const char *region_names[MEM_REGION_MAX] = {"dram", "psram"};
+
+    uint32_t frames = 0;
+    portENTER_CRITICAL(&mem_mux);
+    for (int i = 0; i < MEM_BUDGET_PIPELINES; ++i)
+        frames += pipelines[i].frames;
+    portEXIT_CRITICAL(&mem_mux);
+    w.field("frames", frames);
+    w.field("steady_violations", steady_violations);
+    w.field("strict", (int32_t)MEM_BUDGET_STRICT);
+    w.beginObject("heap");
+    for (int r = 0; r < MEM_REGION_MAX; ++r){
+        w.beginObject(region_names[r]);
+        w.field("free", heap_caps_get_free_size(region_caps[r]));
+        w.field("min_free", heap_caps_get_minimum_free_size(region_caps[r]));
+        w.field("largest_free_block", heap_caps_get_largest_free_block(region_caps[r]));
+        w.endObject();
+    }
+    w.endObject();
+    w.beginObject("stages");
+    for (int s = 0; s < MEM_STAGE_MAX; ++s){
+        w.beginObject(stage_names[s]);
+        for (int r = 0; r < MEM_REGION_MAX; ++r){
+            mem_counter_t c;
+            mem_budget_get((mem_stage_t)s, (mem_region_t)r, &c);
+            w.beginObject(region_names[r]);
+            w.field("allocs", c.allocs);
+            w.field("frees", c.frees);
+            w.field("live_count", c.live_count);
+            w.field("live", c.live_bytes);
+            w.field("peak", c.peak_bytes);
+            w.endObject();
+        }
+        w.endObject();
+    }
+    w.endObject();
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include "Arduino.h"
+#include "esp_heap_caps.h"
+#include "json_writer.h"
+
+// Heap and PSRAM accounting per pipeline stage.
+//
+// Allocations made through mem_budget_malloc() are tagged with a small header
+// and counted exactly. Allocations made inside third-party code (frame2jpg,
+// dl_matrix3du_alloc, ...) cannot be tagged, so the call is wrapped in a
+// MemScope: it counts one allocation event for the stage and attributes the
+// heap delta observed across the call (approximate, other tasks share the heap).
+//
+// A pipeline is a task that brackets its frames with mem_budget_frame_begin()
+// and mem_budget_frame_end(): loop() on core 1 and the stream encoder on core 0
+// run one each. Allocation events are attributed to the task that made them, so
+// each pipeline keeps its own count and frame number and one pipeline's
+// allocations never show up in the other's frame.
+
+#ifndef MEM_BUDGET_STRICT
+#if CORE_DEBUG_LEVEL >= 4
+#define MEM_BUDGET_STRICT 1
+#else
+#define MEM_BUDGET_STRICT 0
+#endif
+#endif
+
+// frames a pipeline may allocate in after boot, or after mem_budget_rewarm(),
+// before it counts as steady state
+#define MEM_BUDGET_WARMUP_FRAMES 8
+// tasks that can bracket frames
+#define MEM_BUDGET_PIPELINES 4
+
+typedef enum {
+    MEM_STAGE_DETECT = 0,
+    MEM_STAGE_FACE,
+    MEM_STAGE_ENCODE,
+    MEM_STAGE_STREAM,
+    MEM_STAGE_HTTP,
+    MEM_STAGE_MAX
+} mem_stage_t;
+
+typedef enum {
+    MEM_REGION_INTERNAL = 0,
+    MEM_REGION_PSRAM,
+    MEM_REGION_MAX
+} mem_region_t;
+
+typedef struct {
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t live_count;
+    int32_t live_bytes;
+    int32_t peak_bytes; //high-water mark of live_bytes
+} mem_counter_t;
+
+typedef struct {
+    uint8_t pipeline; //MEM_BUDGET_PIPELINES when the table was full
+    uint32_t allocs;  //allocation events of the pipeline when the frame began
+    uint32_t number;  //frame of this pipeline
+} mem_frame_t;
+
+void *mem_budget_malloc(mem_stage_t stage, size_t size, uint32_t caps);
+void mem_budget_free(void *ptr);
+
+void mem_budget_frame_begin(mem_frame_t *frame);
+void mem_budget_frame_end(mem_frame_t *frame, const char *who);
+// a frame size or buffer size change: the frames in progress and the next
+// MEM_BUDGET_WARMUP_FRAMES of every pipeline may allocate again
+void mem_budget_rewarm();
+
+void mem_budget_get(mem_stage_t stage, mem_region_t region, mem_counter_t *out);
+const char *mem_budget_stage_name(mem_stage_t stage);
+// writes the counters and heap state into the object w is in
+void mem_budget_write_json(JsonWriter &w);
+
+struct MemScope{
+    const mem_stage_t stage;
+    size_t internal_free;
+    size_t psram_free;
+
+    MemScope(mem_stage_t s);
+    ~MemScope();
+};
@@ -0,0 +1,81 @@
+#include "morphology.h"
+
+static inline uint32_t last_word_mask(uint32_t width){
+    return (width & 31) ? (1u << (width & 31)) - 1 : 0xFFFFFFFF;
+}
+
+// the step that takes a reach of k towards r without leaving a gap
+static inline uint32_t next_step(uint32_t k, uint32_t r){
+    return k + 1 < r - k ? k + 1 : r - k;
+}
+
+// row | row shifted s columns either way, 0 < s < 32
+static void IRAM_ATTR spread_row(uint32_t *row, uint32_t stride, uint32_t s, uint32_t last){
+    uint32_t prev = 0;
+    for (uint32_t i = 0; i < stride; ++i){
+        const uint32_t cur = row[i];
+        const uint32_t next = i + 1 < stride ? row[i + 1] : 0;
+        row[i] = cur | (cur << s) | (prev >> (32 - s)) | (cur >> s) | (next << (32 - s));
+        prev = cur;
+    }
+    row[stride - 1] &= last;
+}
+
+static void invert(uint32_t *mask, uint32_t height, uint32_t stride, uint32_t last){
+    for (uint32_t y = 0; y < height; ++y){
+        uint32_t *row = mask + y * stride;
+        for (uint32_t i = 0; i < stride; ++i)
+            row[i] = ~row[i];
+        row[stride - 1] &= last;
+    }
+}
+
+void IRAM_ATTR morph_dilate(uint32_t *mask, uint32_t *tmp, uint32_t width, uint32_t height, uint32_t stride, uint32_t radius){
+    if (!radius || !width || !height)
+        return;
+    if (radius > MORPH_MAX_RADIUS)
+        radius = MORPH_MAX_RADIUS;
+    const uint32_t last = last_word_mask(width);
+
+    for (uint32_t y = 0; y < height; ++y){
+        for (uint32_t k = 0; k < radius; ){
+            const uint32_t s = next_step(k, radius);
+            spread_row(mask + y * stride, stride, s, last);
+            k += s;
+        }
+    }
+
+    uint32_t *src = mask;
+    uint32_t *dst = tmp;
+    for (uint32_t k = 0; k < radius; ){
+        const uint32_t s = next_step(k, radius);
+        for (uint32_t y = 0; y < height; ++y){
+            const uint32_t *up = y >= s ? src + (y - s) * stride : NULL;
+            const uint32_t *down = y + s < height ? src + (y + s) * stride : NULL;
+            const uint32_t *cur = src + y * stride;
+            uint32_t *out = dst + y * stride;
+            for (uint32_t i = 0; i < stride; ++i)
+                out[i] = cur[i] | (up ? up[i] : 0) | (down ? down[i] : 0);
+        }
+        uint32_t *t = src;
+        src = dst;
+        dst = t;
+        k += s;
+    }
+    if (src != mask)
+        memcpy(mask, src, height * stride * sizeof(uint32_t));
+}
+
+void morph_erode(uint32_t *mask, uint32_t *tmp, uint32_t width, uint32_t height, uint32_t stride, uint32_t radius){
+    if (!radius || !width || !height)
+        return;
+    const uint32_t last = last_word_mask(width);
+    invert(mask, height, stride, last);
+    morph_dilate(mask, tmp, width, height, stride, radius);
+    invert(mask, height, stride, last);
+}
+
+void morph_open(uint32_t *mask, uint32_t *tmp, uint32_t width, uint32_t height, uint32_t stride, uint32_t radius){
+    morph_erode(mask, tmp, width, height, stride, radius);
+    morph_dilate(mask, tmp, width, height, stride, radius);
+}
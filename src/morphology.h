@@ -0,0 +1,141 @@
+#pragma once
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <string.h>
+#define IRAM_ATTR
+#endif
+
+// Morphology on bit masks, 32 pixels per word.
+//
+// Masks are rows of `stride` words, column x at bit x & 31 of word x >> 5, and
+// the bits past the width are zero. Dilation is separable: every row is ORed
+// with itself shifted left and right, carrying across words, then every row
+// with the rows above and below. Each step doubles the reach, so a radius r
+// takes about log2(r) passes over the mask. Erosion is the dilation of the
+// complement, with everything outside the mask counted as set so blobs on the
+// border do not shrink from that side. Opening (erode then dilate) removes
+// specks smaller than the radius and leaves larger blobs as they were.
+//
+// The vertical passes write to tmp, which must be as large as the mask.
+//
+// Nothing here needs the board; test/native/test_morphology checks it and the
+// component walk against brute force on the host.
+
+#define MORPH_MAX_RADIUS 16
+
+void morph_dilate(uint32_t *mask, uint32_t *tmp, uint32_t width, uint32_t height, uint32_t stride, uint32_t radius);
+void morph_erode(uint32_t *mask, uint32_t *tmp, uint32_t width, uint32_t height, uint32_t stride, uint32_t radius);
+void morph_open(uint32_t *mask, uint32_t *tmp, uint32_t width, uint32_t height, uint32_t stride, uint32_t radius);
+
+// the first set column at or after x, width when there is none
+static inline uint32_t morph_next_set(const uint32_t *row, uint32_t x, uint32_t width){
+    while (x < width){
+        const uint32_t word = row[x >> 5] >> (x & 31);
+        if (word){
+            x += __builtin_ctz(word);
+            return x < width ? x : width;
+        }
+        x = (x | 31) + 1;
+    }
+    return width;
+}
+
+// the first clear column at or after x, width when there is none
+static inline uint32_t morph_next_clear(const uint32_t *row, uint32_t x, uint32_t width){
+    while (x < width){
+        const uint32_t word = ~row[x >> 5] >> (x & 31);
+        if (word){
+            x += __builtin_ctz(word);
+            return x < width ? x : width;
+        }
+        x = (x | 31) + 1;
+    }
+    return width;
+}
+
+// the first column of the run of set bits through x
+static inline uint32_t morph_run_start(const uint32_t *row, uint32_t x){
+    uint32_t i = x >> 5;
+    uint32_t word = ~row[i] & ((2u << (x & 31)) - 1);
+    while (!word){
+        if (!i)
+            return 0;
+        word = ~row[--i];
+    }
+    return i * 32 + (31 - __builtin_clz(word)) + 1;
+}
+
+// the bits of columns x0..x1 within word i
+static inline uint32_t morph_span_word(uint32_t i, uint32_t x0, uint32_t x1){
+    const uint32_t lo = x0 > i * 32 ? x0 - i * 32 : 0;
+    const uint32_t hi = x1 < i * 32 + 31 ? x1 - i * 32 : 31;
+    return (0xFFFFFFFFu >> (31 - hi)) & (0xFFFFFFFFu << lo);
+}
+
+typedef struct {
+    uint32_t x0, y0, x1, y1;
+} morph_box_t;
+
+// The 8-connected component of mask through column x of row y, walked a run at
+// a time: a run is cleared from mask when it is visited and queues one point of
+// every run it touches in the rows above and below. The bits of hits under the
+// component are set in done and bounded by box. False when (x, y) is clear.
+// Queue has clear(), push(x, y), pop(x, y) and empty(); the visit order does
+// not change the result.
+template<typename Queue>
+static inline bool morph_component(uint32_t *mask, const uint32_t *hits, uint32_t *done, uint32_t width, uint32_t height,
+                                   uint32_t stride, uint32_t x, uint32_t y, Queue &queue, morph_box_t *box){
+    if (!((mask[y * stride + (x >> 5)] >> (x & 31)) & 1))
+        return false;
+    box->x0 = width;
+    box->y0 = height;
+    box->x1 = 0;
+    box->y1 = 0;
+    queue.clear();
+    queue.push(x, y);
+
+    while (!queue.empty()){
+        queue.pop(x, y);
+        uint32_t *run_row = mask + y * stride;
+        if (!((run_row[x >> 5] >> (x & 31)) & 1))
+            continue; //reached through another run already
+        const uint32_t x0 = morph_run_start(run_row, x);
+        const uint32_t x1 = morph_next_clear(run_row, x, width) - 1;
+        const uint32_t *hit_row = hits + y * stride;
+        uint32_t *done_row = done + y * stride;
+        for (uint32_t i = x0 >> 5; i <= x1 >> 5; ++i){
+            const uint32_t span = morph_span_word(i, x0, x1);
+            const uint32_t found = hit_row[i] & span;
+            run_row[i] &= ~span;
+            if (!found)
+                continue;
+            done_row[i] |= found;
+            const uint32_t lo = i * 32 + __builtin_ctz(found);
+            const uint32_t hi = i * 32 + 31 - __builtin_clz(found);
+            if (box->x0 > lo)
+                box->x0 = lo;
+            if (box->x1 < hi)
+                box->x1 = hi;
+            if (box->y0 > y)
+                box->y0 = y;
+            if (box->y1 < y)
+                box->y1 = y;
+        }
+
+        // diagonal neighbours count, so look one column past either end
+        const uint32_t a = x0 ? x0 - 1 : 0;
+        const uint32_t b = x1 + 1 < width ? x1 + 1 : width - 1;
+        for (int k = 0; k < 2; ++k){
+            const uint32_t ny = k ? y + 1 : y - 1;
+            if (ny >= height)
+                continue; //above row 0 wraps around
+            const uint32_t *next_row = mask + ny * stride;
+            for (uint32_t nx = morph_next_set(next_row, a, width); nx <= b;
+                 nx = morph_next_set(next_row, morph_next_clear(next_row, nx, width), width))
+                queue.push(nx, ny);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,210 @@
+#include "motion_gate.h"
+#include "mem_budget.h"
+#include "esp_timer.h"
+
+static uint8_t *planes[2] = {NULL, NULL};
+static uint8_t current = 0;
+static bool reference = false; //planes[current ^ 1] holds the previous frame
+static uint16_t frame_width = 0;
+static uint16_t frame_height = 0;
+static uint16_t plane_width = 0; //padded to whole blocks
+static uint16_t plane_height = 0;
+static uint32_t last_change[MOTION_MAX_BLOCKS];
+static uint32_t last_any_change = 0;
+static bool bypass = true;
+static motion_gate_stats_t stats = {true, MOTION_THRESHOLD, 0, 0, 0, 0, 0, 0, 0};
+
+// bytewise |a - b| of four samples, each halved to 7 bits so the subtraction
+// cannot borrow across bytes
+static inline uint32_t absdiff4(uint32_t a, uint32_t b){
+    a = (a >> 1) & 0x7F7F7F7F;
+    b = (b >> 1) & 0x7F7F7F7F;
+    uint32_t d = ((a | 0x80808080) - b) ^ 0x80808080; //a - b as signed bytes
+    const uint32_t negative = (d >> 7) & 0x01010101;
+    return (d ^ (negative * 0xFF)) + negative;
+}
+
+static void release_planes(){
+    mem_budget_free(planes[0]);
+    mem_budget_free(planes[1]);
+    planes[0] = planes[1] = NULL;
+    reference = false;
+}
+
+static bool prepare(uint16_t width, uint16_t height){
+    if (planes[0] && width == frame_width && height == frame_height)
+        return true;
+    release_planes();
+    frame_width = width;
+    frame_height = height;
+
+    uint16_t step = (width + MOTION_PLANE_WIDTH - 1) / MOTION_PLANE_WIDTH;
+    if (step < 2)
+        step = 2;
+    uint16_t cols, rows;
+    while (true){
+        cols = (width / step + MOTION_BLOCK - 1) / MOTION_BLOCK;
+        rows = (height / step + MOTION_BLOCK - 1) / MOTION_BLOCK;
+        if (cols * rows <= MOTION_MAX_BLOCKS)
+            break;
+        step++;
+    }
+    stats.step = step;
+    stats.cols = cols;
+    stats.rows = rows;
+    plane_width = cols * MOTION_BLOCK;
+    plane_height = rows * MOTION_BLOCK;
+
+    const size_t bytes = plane_width * plane_height;
+    const uint32_t caps = bytes <= 8192 ? MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT : MALLOC_CAP_SPIRAM;
+    for (int i = 0; i < 2; ++i){
+        planes[i] = (uint8_t *)mem_budget_malloc(MEM_STAGE_DETECT, bytes, caps);
+        if (!planes[i]){
+            Serial.println("motion gate: could not allocate the sample planes");
+            release_planes();
+            return false;
+        }
+        // the padding stays zero in both planes and never differs
+        memset(planes[i], 0, bytes);
+    }
+    return true;
+}
+
+// one sample per step pixels: green for RGB, luma for YUV and grayscale
+static void sample(camera_fb_t *fb, uint8_t *plane){
+    const uint32_t step = stats.step;
+    const uint32_t samples_x = fb->width / step;
+    const uint32_t samples_y = fb->height / step;
+    for (uint32_t sy = 0; sy < samples_y; ++sy){
+        uint8_t *out = plane + sy * plane_width;
+        switch (fb->format){
+            case PIXFORMAT_RGB888: {
+                const uint8_t *p = fb->buf + (sy * step * fb->width) * 3 + 1;
+                for (uint32_t sx = 0; sx < samples_x; ++sx, p += step * 3)
+                    out[sx] = *p;
+                break;
+            }
+            case PIXFORMAT_RGB565: {
+                const uint8_t *p = fb->buf + (sy * step * fb->width) * 2;
+                for (uint32_t sx = 0; sx < samples_x; ++sx, p += step * 2)
+                    out[sx] = ((p[0] & 0x07) << 5) | ((p[1] & 0xE0) >> 3);
+                break;
+            }
+            case PIXFORMAT_YUV422: {
+                const uint8_t *p = fb->buf + (sy * step * fb->width) * 2;
+                for (uint32_t sx = 0; sx < samples_x; ++sx, p += step * 2)
+                    out[sx] = *p;
+                break;
+            }
+            default: {
+                const uint8_t *p = fb->buf + sy * step * fb->width;
+                for (uint32_t sx = 0; sx < samples_x; ++sx, p += step)
+                    out[sx] = *p;
+                break;
+            }
+        }
+    }
+}
+
+static uint16_t compare(const uint8_t *cur, const uint8_t *ref){
+    // block sums of 7 bit differences, the threshold is in 8 bit units
+    const uint32_t limit = (uint32_t)stats.threshold * MOTION_BLOCK * MOTION_BLOCK / 2;
+    const uint32_t words = plane_width / 4;
+    const uint32_t block_words = MOTION_BLOCK / 4;
+    static uint32_t acc[MOTION_MAX_BLOCKS]; //only loop() compares
+    uint16_t changed = 0;
+
+    for (uint32_t by = 0; by < stats.rows; ++by){
+        memset(acc, 0, stats.cols * sizeof(uint32_t));
+        for (uint32_t r = 0; r < MOTION_BLOCK; ++r){
+            const uint32_t *c = (const uint32_t *)(cur + (by * MOTION_BLOCK + r) * plane_width);
+            const uint32_t *p = (const uint32_t *)(ref + (by * MOTION_BLOCK + r) * plane_width);
+            for (uint32_t w = 0; w < words; ++w){
+                const uint32_t d = absdiff4(c[w], p[w]);
+                // two 16 bit lanes, a block stays far below their range
+                acc[w / block_words] += (d & 0x00FF00FF) + ((d >> 8) & 0x00FF00FF);
+            }
+        }
+        for (uint32_t bx = 0; bx < stats.cols; ++bx){
+            const uint32_t sum = (acc[bx] & 0xFFFF) + (acc[bx] >> 16);
+            if (sum > limit){
+                last_change[by * stats.cols + bx] = stats.frame;
+                changed++;
+            }
+        }
+    }
+    return changed;
+}
+
+void motion_gate_update(camera_fb_t *fb){
+    const int64_t start = esp_timer_get_time();
+    stats.frame++;
+    bypass = !stats.enabled || fb->format == PIXFORMAT_JPEG || !prepare(fb->width, fb->height);
+    if (bypass){
+        reference = false;
+        last_any_change = stats.frame;
+        return;
+    }
+
+    uint8_t *cur = planes[current];
+    sample(fb, cur);
+    uint16_t changed;
+    if (reference){
+        changed = compare(cur, planes[current ^ 1]);
+    } else {
+        // nothing to compare with, everything counts as new
+        changed = stats.cols * stats.rows;
+        for (uint32_t b = 0; b < changed; ++b)
+            last_change[b] = stats.frame;
+    }
+    current ^= 1;
+    reference = true;
+
+    stats.changed = changed;
+    if (changed)
+        last_any_change = stats.frame;
+    else
+        stats.idle_frames++;
+    stats.last_us = esp_timer_get_time() - start;
+}
+
+uint32_t motion_gate_frame(){
+    return stats.frame;
+}
+
+bool motion_gate_changed_since(uint32_t frame, uint32_t x, uint32_t y, uint32_t w, uint32_t h){
+    if (bypass)
+        return true;
+    const uint32_t size = stats.step * MOTION_BLOCK;
+    const uint32_t bx0 = x / size;
+    const uint32_t by0 = y / size;
+    uint32_t bx1 = (x + (w ? w : 1) - 1) / size;
+    uint32_t by1 = (y + (h ? h : 1) - 1) / size;
+    if (bx1 >= stats.cols)
+        bx1 = stats.cols - 1;
+    if (by1 >= stats.rows)
+        by1 = stats.rows - 1;
+    for (uint32_t by = by0; by <= by1; ++by){
+        for (uint32_t bx = bx0; bx <= bx1; ++bx){
+            if (last_change[by * stats.cols + bx] > frame)
+                return true;
+        }
+    }
+    return false;
+}
+
+bool motion_gate_frame_changed_since(uint32_t frame){
+    return bypass || last_any_change > frame;
+}
+
+void motion_gate_set_enabled(bool enabled){
+    stats.enabled = enabled;
+}
+
+void motion_gate_set_threshold(uint8_t threshold){
+    stats.threshold = threshold;
+}
+
+void motion_gate_get_stats(motion_gate_stats_t *out){
+    *out = stats;
+}
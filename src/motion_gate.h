@@ -0,0 +1,51 @@
+#pragma once
+#include "Arduino.h"
+#include "esp_camera.h"
+
+// Change detection that lets idle scenes skip work.
+//
+// loop() hands every frame to motion_gate_update() before the detector runs.
+// It samples one channel (green, or luma for YUV and grayscale) every `step`
+// pixels into a plane of at most about MOTION_PLANE_WIDTH samples per row, and
+// compares it with the previous frame's plane in blocks of
+// MOTION_BLOCK x MOTION_BLOCK samples. The block SAD is computed four samples
+// to a word: samples are halved to 7 bits so a bytewise difference cannot
+// borrow into its neighbour, the absolute value is taken with the sign bits,
+// and the bytes are summed in two 16 bit lanes. A block whose mean difference
+// exceeds the threshold records the frame number as its last change.
+//
+// Consumers remember the frame they last did their work at and ask whether
+// anything in their region changed since: the legacy detector skips bands,
+// the tiled detector and face detection reuse their last result, and the
+// stream skips re-encoding a frame that shows nothing new (but still sends
+// one every MOTION_REFRESH_MS). With the gate off, or for JPEG frames,
+// everything counts as changed.
+
+#define MOTION_BLOCK 8          //samples per block side
+#define MOTION_PLANE_WIDTH 160  //sample columns the step aims for
+#define MOTION_MAX_BLOCKS 512
+#define MOTION_THRESHOLD 8      //mean absolute difference per sample, 0..255
+#define MOTION_REFRESH_MS 1000
+
+typedef struct {
+    bool enabled;
+    uint8_t threshold;
+    uint16_t step;          //pixels per sample
+    uint16_t cols;          //blocks per row
+    uint16_t rows;
+    uint16_t changed;       //blocks changed in the last frame
+    uint32_t frame;
+    uint32_t idle_frames;   //frames with no block changed
+    uint32_t last_us;
+} motion_gate_stats_t;
+
+void motion_gate_update(camera_fb_t *fb);
+// number of the last frame analyzed
+uint32_t motion_gate_frame();
+// whether a block overlapping the pixel rectangle changed after frame
+bool motion_gate_changed_since(uint32_t frame, uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+bool motion_gate_frame_changed_since(uint32_t frame);
+
+void motion_gate_set_enabled(bool enabled);
+void motion_gate_set_threshold(uint8_t threshold);
+void motion_gate_get_stats(motion_gate_stats_t *out);
@@ -0,0 +1,114 @@
+#include "mtmn_tuner.h"
+
+typedef struct {
+    uint16_t min_face;
+    float pyramid;
+    uint8_t pyramid_times;
+} mtmn_profile_t;
+
+// cheapest first, each step finds smaller or less frontal faces
+static const mtmn_profile_t profiles[] = {
+    {160, 0.600f, 2},
+    {120, 0.650f, 3},
+    {100, 0.707f, 3},
+    {80, 0.707f, 4},
+    {64, 0.707f, 4},
+    {48, 0.750f, 5},
+};
+#define PROFILES (sizeof(profiles) / sizeof(profiles[0]))
+
+static portMUX_TYPE tuner_mux = portMUX_INITIALIZER_UNLOCKED;
+static mtmn_config_t config;
+static bool enabled = true;
+static uint8_t profile = MTMN_TUNE_DEFAULT;
+static uint8_t held = 0; //detections measured on the current profile
+static float us_per_work = 0;
+static uint32_t budget_ms = MTMN_TUNE_BUDGET_MS;
+static uint32_t detect_us = 0;
+static uint32_t predicted_us = 0;
+static uint32_t switches = 0;
+
+static float work(const mtmn_profile_t &p, int width, int height){
+    const float scale = 12.0f / p.min_face;
+    float levels = 0;
+    float level = 1;
+    for (int k = 0; k < p.pyramid_times; ++k){
+        levels += level;
+        level *= p.pyramid * p.pyramid;
+    }
+    return (float)width * height * scale * scale * levels;
+}
+
+// tuner_mux held
+static void apply(uint8_t p){
+    profile = p;
+    held = 0;
+    config.min_face = profiles[p].min_face;
+    config.pyramid = profiles[p].pyramid;
+    config.pyramid_times = profiles[p].pyramid_times;
+}
+
+void mtmn_tuner_init(const mtmn_config_t *base){
+    portENTER_CRITICAL(&tuner_mux);
+    config = *base;
+    apply(MTMN_TUNE_DEFAULT);
+    portEXIT_CRITICAL(&tuner_mux);
+}
+
+void mtmn_tuner_get_config(mtmn_config_t *out){
+    portENTER_CRITICAL(&tuner_mux);
+    *out = config;
+    portEXIT_CRITICAL(&tuner_mux);
+}
+
+void mtmn_tuner_measured(int width, int height, uint32_t us){
+    portENTER_CRITICAL(&tuner_mux);
+    detect_us = held ? (detect_us * 3 + us) / 4 : us;
+    const float rate = us / work(profiles[profile], width, height);
+    us_per_work = us_per_work > 0 ? (us_per_work * 3 + rate) / 4 : rate;
+    if (enabled && ++held >= MTMN_TUNE_HOLD){
+        // the most thorough profile predicted to fit
+        uint8_t best = 0;
+        for (uint8_t p = 0; p < PROFILES; ++p){
+            if (us_per_work * work(profiles[p], width, height) <= budget_ms * 1000.0f)
+                best = p;
+        }
+        predicted_us = us_per_work * work(profiles[best], width, height);
+        if (best != profile){
+            apply(best);
+            switches++;
+        } else {
+            held = MTMN_TUNE_HOLD;
+        }
+    }
+    portEXIT_CRITICAL(&tuner_mux);
+}
+
+void mtmn_tuner_set_enabled(bool e){
+    portENTER_CRITICAL(&tuner_mux);
+    enabled = e;
+    if (!enabled)
+        apply(MTMN_TUNE_DEFAULT);
+    portEXIT_CRITICAL(&tuner_mux);
+}
+
+void mtmn_tuner_set_budget(uint32_t ms){
+    portENTER_CRITICAL(&tuner_mux);
+    budget_ms = ms ? ms : 1;
+    held = 0;
+    portEXIT_CRITICAL(&tuner_mux);
+}
+
+void mtmn_tuner_get(mtmn_tuner_state_t *out){
+    portENTER_CRITICAL(&tuner_mux);
+    out->enabled = enabled;
+    out->profile = profile;
+    out->min_face = config.min_face;
+    out->pyramid_milli = config.pyramid * 1000 + 0.5f;
+    out->pyramid_times = config.pyramid_times;
+    out->budget_ms = budget_ms;
+    out->detect_us = detect_us;
+    out->predicted_us = predicted_us;
+    out->switches = switches;
+    portEXIT_CRITICAL(&tuner_mux);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "Arduino.h"
+#include "fd_forward.h"
+
+// Time-budgeted MTMN configuration.
+//
+// face_detect's cost is dominated by P-Net, which runs on every pyramid level
+// of the frame scaled so min_face becomes 12 px. The work of a profile is
+// therefore modelled as the pixel count over its levels,
+//     w * h * (12 / min_face)^2 * sum(pyramid^(2k)), k < pyramid_times,
+// and each measured detection updates the cost per unit of work. After
+// MTMN_TUNE_HOLD detections on a profile the tuner moves to the most thorough
+// profile of the ladder whose predicted cost fits the budget, so it follows
+// framesize changes and scene load without trying every profile. A new frame
+// size keeps the cost per unit, the model rescales for it.
+//
+// With tuning off the config is the original fixed one (MTMN_TUNE_DEFAULT).
+
+#define MTMN_TUNE_BUDGET_MS 120
+#define MTMN_TUNE_HOLD 4
+#define MTMN_TUNE_DEFAULT 3 //min_face 80, pyramid 0.707, 4 levels
+
+typedef struct {
+    bool enabled;
+    uint8_t profile;
+    uint16_t min_face;
+    uint16_t pyramid_milli;
+    uint8_t pyramid_times;
+    uint32_t budget_ms;
+    uint32_t detect_us;  //smoothed cost of the current profile
+    uint32_t predicted_us;
+    uint32_t switches;
+} mtmn_tuner_state_t;
+
+void mtmn_tuner_init(const mtmn_config_t *base);
+void mtmn_tuner_get_config(mtmn_config_t *out);
+// one face_detect call on a width x height frame took us
+void mtmn_tuner_measured(int width, int height, uint32_t us);
+
+void mtmn_tuner_set_enabled(bool enabled);
+void mtmn_tuner_set_budget(uint32_t ms);
+void mtmn_tuner_get(mtmn_tuner_state_t *out);
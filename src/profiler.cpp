@@ -0,0 +1,135 @@
+#include "profiler.h"
+#include "mem_budget.h"
+
+#if PROFILER_ENABLED
+#include "esp_freertos_hooks.h"
+#include "esp_spi_flash.h"
+#include "freertos/xtensa_context.h"
+#include "soc/soc.h"
+
+static profiler_sample_t *samples = NULL;
+static volatile bool running = false;
+static volatile uint32_t head = 0;
+static volatile uint32_t dropped = 0;
+static uint32_t divider = 1;
+static uint32_t ticks[portNUM_PROCESSORS];
+static portMUX_TYPE profiler_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static inline bool IRAM_ATTR pc_valid(uint32_t pc){
+    return (pc >= SOC_IROM_LOW && pc < SOC_IROM_HIGH) || (pc >= SOC_IRAM_LOW && pc < SOC_IRAM_HIGH);
+}
+
+static inline bool IRAM_ATTR sp_valid(uint32_t sp){
+    if (sp & 0xF)
+        return false;
+    return (sp > SOC_DRAM_LOW + 16 && sp < SOC_DRAM_HIGH) || (sp > SOC_EXTRAM_DATA_LOW + 16 && sp < SOC_EXTRAM_DATA_HIGH);
+}
+
+// windowed call8/call12 return addresses keep the window size in the top bits
+static inline uint32_t IRAM_ATTR return_pc(uint32_t ra){
+    return ((ra & 0x3fffffff) | 0x40000000) - 3;
+}
+
+static void IRAM_ATTR profiler_tick(){
+    if (!running)
+        return;
+    const int core = xPortGetCoreID();
+    if (++ticks[core] < divider)
+        return;
+    ticks[core] = 0;
+    // the sample buffer lives in PSRAM, which is unreachable during flash writes
+    if (!spi_flash_cache_enabled()){
+        dropped++;
+        return;
+    }
+    TaskHandle_t task = xTaskGetCurrentTaskHandleForCPU(core);
+    if (!task)
+        return;
+    // pxTopOfStack is the first TCB member; on ISR entry it points at the
+    // frame the interrupted context was spilled into
+    const XtExcFrame *frame = *(const XtExcFrame **)task;
+
+    portENTER_CRITICAL_ISR(&profiler_mux);
+    const uint32_t index = head;
+    if (index >= PROFILER_SAMPLES){
+        dropped++;
+        portEXIT_CRITICAL_ISR(&profiler_mux);
+        return;
+    }
+    head = index + 1;
+    portEXIT_CRITICAL_ISR(&profiler_mux);
+
+    profiler_sample_t *s = &samples[index];
+    uint32_t pc = frame->pc;
+    uint32_t sp = frame->a1;
+    uint32_t next_pc = frame->a0;
+    uint8_t depth = 0;
+    s->core = core;
+    s->pc[depth++] = pc;
+    while (depth < PROFILER_DEPTH && next_pc && sp_valid(sp)){
+        pc = return_pc(next_pc);
+        if (!pc_valid(pc))
+            break;
+        s->pc[depth++] = pc;
+        // the caller's a0/a1 sit in the base save area just below sp
+        next_pc = *(uint32_t *)(sp - 16);
+        sp = *(uint32_t *)(sp - 12);
+    }
+    s->depth = depth;
+}
+
+bool profiler_start(uint32_t hz){
+    if (running)
+        return true;
+    if (!samples){
+        samples = (profiler_sample_t *)mem_budget_malloc(MEM_STAGE_HTTP, PROFILER_SAMPLES * sizeof(profiler_sample_t), MALLOC_CAP_SPIRAM);
+        if (!samples)
+            return false;
+        for (int core = 0; core < portNUM_PROCESSORS; ++core){
+            if (esp_register_freertos_tick_hook_for_cpu(profiler_tick, core) != ESP_OK){
+                Serial.printf("profiler: tick hook on core %d failed\n", core);
+                return false;
+            }
+        }
+    }
+    if (!hz || hz > configTICK_RATE_HZ)
+        hz = configTICK_RATE_HZ;
+    divider = configTICK_RATE_HZ / hz;
+    head = 0;
+    dropped = 0;
+    running = true;
+    return true;
+}
+
+void profiler_stop(){
+    running = false;
+}
+
+bool profiler_running(){
+    return running;
+}
+
+size_t profiler_count(){
+    return head;
+}
+
+uint32_t profiler_dropped(){
+    return dropped;
+}
+
+const profiler_sample_t *profiler_sample(size_t index){
+    if (!samples || index >= head)
+        return NULL;
+    return &samples[index];
+}
+
+#else
+
+bool profiler_start(uint32_t hz){ return false; }
+void profiler_stop(){}
+bool profiler_running(){ return false; }
+size_t profiler_count(){ return 0; }
+uint32_t profiler_dropped(){ return 0; }
+const profiler_sample_t *profiler_sample(size_t index){ return NULL; }
+
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+#include "Arduino.h"
+
+// Sampling CPU profiler. A FreeRTOS tick hook on each core records the
+// interrupted PC plus a short backtrace into a PSRAM buffer. The buffer fills
+// from the start and holds the first PROFILER_SAMPLES samples of a run; ticks
+// after that, like ticks during flash writes, only count as dropped until the
+// next profiler_start(). Build with -DPROFILER_ENABLED=1 to compile it in, then
+// drive it through /profile.
+// tools/fold_stacks.py turns a dump into folded stacks for flame graphs.
+
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 0
+#endif
+
+#define PROFILER_DEPTH 8
+#define PROFILER_SAMPLES 16384
+
+typedef struct {
+    uint8_t core;
+    uint8_t depth;
+    uint16_t reserved;
+    uint32_t pc[PROFILER_DEPTH];
+} profiler_sample_t;
+
+bool profiler_start(uint32_t hz);
+void profiler_stop();
+bool profiler_running();
+size_t profiler_count();
+uint32_t profiler_dropped();
+const profiler_sample_t *profiler_sample(size_t index);
@@ -0,0 +1,70 @@
+#include "raw_frame.h"
+#include "definations.h"
+
+esp_err_t raw_frame_send(httpd_req_t *req, camera_fb_t *fb, raw_frame_window_t win, int64_t timestamp){
+    const uint32_t bpp = frame_bpp(fb->format);
+    // header.step is 16 bits, and a step past the width keeps one column
+    const uint32_t max_step = fb->width < 0xFFFF ? fb->width : 0xFFFF;
+    if (!bpp || !win.step || win.step > max_step || win.x >= fb->width || win.y >= fb->height)
+        return ESP_ERR_INVALID_ARG;
+    // compared against what is left so a huge w or h cannot wrap the sum
+    if (!win.w || win.w > fb->width - win.x)
+        win.w = fb->width - win.x;
+    if (!win.h || win.h > fb->height - win.y)
+        win.h = fb->height - win.y;
+    if (fb->format == PIXFORMAT_YUV422){
+        if (win.step != 1)
+            return ESP_ERR_INVALID_ARG;
+        win.x &= ~1;
+        win.w &= ~1;
+        if (!win.w)
+            return ESP_ERR_INVALID_ARG;
+    }
+
+    raw_frame_header_t header;
+    header.magic = RAW_FRAME_MAGIC;
+    header.version = RAW_FRAME_VERSION;
+    header.format = fb->format;
+    header.width = (win.w + win.step - 1) / win.step;
+    header.height = (win.h + win.step - 1) / win.step;
+    header.x = win.x;
+    header.y = win.y;
+    header.step = win.step;
+    header.frame_width = fb->width;
+    header.frame_height = fb->height;
+    header.bpp = bpp;
+    header.reserved = 0;
+    header.timestamp = timestamp;
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=frame.raw");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    esp_err_t res = httpd_resp_send_chunk(req, (const char *)&header, sizeof(header));
+
+    const size_t stride = fb->width * bpp;
+    const uint8_t *src = fb->buf + win.y * stride + win.x * bpp;
+    if (win.step == 1 && win.w == fb->width){
+        // full rows are one contiguous block of the frame buffer
+        if (res == ESP_OK)
+            res = httpd_resp_send_chunk(req, (const char *)src, win.h * stride);
+    } else if (win.step == 1){
+        for (uint32_t y = 0; y < win.h && res == ESP_OK; ++y)
+            res = httpd_resp_send_chunk(req, (const char *)src + y * stride, win.w * bpp);
+    } else {
+        const size_t row_len = header.width * bpp;
+        uint8_t *row = (uint8_t *)mem_budget_malloc(MEM_STAGE_HTTP, row_len, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (!row)
+            res = ESP_ERR_NO_MEM;
+        for (uint32_t y = 0; y < win.h && res == ESP_OK; y += win.step){
+            const uint8_t *in = src + y * stride;
+            uint8_t *out = row;
+            for (uint32_t x = 0; x < win.w; x += win.step, out += bpp)
+                memcpy(out, in + x * bpp, bpp);
+            res = httpd_resp_send_chunk(req, (const char *)row, row_len);
+        }
+        mem_budget_free(row);
+    }
+    if (res == ESP_OK)
+        res = httpd_resp_send_chunk(req, NULL, 0);
+    return res;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include "Arduino.h"
+#include "esp_camera.h"
+#include "esp_http_server.h"
+
+// /raw: the exact pixels the detector sees, without any conversion.
+//
+// The response is a raw_frame_header_t followed by height rows of
+// width * bpp bytes in the sensor's own format and byte order. x, y, w and h
+// select a window of the frame and step keeps every step-th pixel of every
+// step-th row. Rows of an undecimated window are sent straight out of the
+// frame buffer, the whole window in one piece when it spans full rows; a
+// decimated row is gathered into a single row buffer first. YUV422 comes in
+// pixel pairs, so its windows snap to even x and w and it cannot be decimated.
+// tools/raw_reader.py fetches and stores these for replay.
+
+#define RAW_FRAME_MAGIC 0x57415246 //"FRAW" read little endian
+#define RAW_FRAME_VERSION 1
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t format;       //pixformat_t
+    uint16_t width;        //of the payload
+    uint16_t height;
+    uint16_t x;            //window origin in the frame
+    uint16_t y;
+    uint16_t step;
+    uint16_t frame_width;
+    uint16_t frame_height;
+    uint8_t bpp;
+    uint8_t reserved;
+    uint64_t timestamp;    //capture time, microseconds since boot
+} raw_frame_header_t;
+
+typedef struct {
+    uint32_t x;
+    uint32_t y;
+    uint32_t w; //0 for the rest of the frame
+    uint32_t h;
+    uint32_t step;
+} raw_frame_window_t;
+
+// Sends fb as a chunked /raw response, ESP_ERR_INVALID_ARG (nothing sent)
+// when the format or window is not supported. The window is clamped to the
+// frame and step must be 1..min(width, 65535).
+esp_err_t raw_frame_send(httpd_req_t *req, camera_fb_t *fb, raw_frame_window_t window, int64_t timestamp);
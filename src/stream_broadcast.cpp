@@ -0,0 +1,326 @@
+#include "stream_broadcast.h"
+#include "mem_budget.h"
+#include "stream_rate.h"
+#include "lwip/sockets.h"
+
+static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
+
+typedef struct {
+    httpd_handle_t hd;
+    bool in_use;
+    bool closing; //send failed, waiting for httpd to drop the session
+    stream_fanout_t out;
+} stream_client_t;
+
+// clients_lock is held by the sender around every send and by httpd while it
+// tears a session down, so a socket is never written after httpd closed it
+static stream_client_t clients[STREAM_MAX_CLIENTS];
+static SemaphoreHandle_t clients_lock = xSemaphoreCreateMutex();
+static TaskHandle_t sender_task = NULL;
+static portMUX_TYPE frame_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t frame_ids = 0;
+
+static jpeg_frame_t pool[JPEG_POOL_SIZE]; //a slot is free while its refs are 0
+static jpeg_pool_stats_t pool_stats;
+static size_t pool_avg = 0; //running average of the JPEG size
+
+static uint8_t *frame_buf_alloc(size_t size){
+    uint8_t *buf = (uint8_t *)mem_budget_malloc(MEM_STAGE_ENCODE, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!buf)
+        buf = (uint8_t *)mem_budget_malloc(MEM_STAGE_ENCODE, size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    return buf;
+}
+
+static bool frame_resize(jpeg_frame_t *frame, size_t cap, size_t keep){
+    uint8_t *buf = frame_buf_alloc(cap);
+    if (!buf)
+        return false;
+    // the JPEG size changed with the frame size or quality, not a leak
+    mem_budget_rewarm();
+    if (keep)
+        memcpy(buf + STREAM_PART_HEADROOM, frame->buf + STREAM_PART_HEADROOM, keep);
+    mem_budget_free(frame->buf);
+    frame->buf = buf;
+    frame->cap = cap;
+    return true;
+}
+
+// a free slot sized for about size bytes of JPEG, NULL when all are in flight
+static jpeg_frame_t *frame_acquire(size_t size){
+    jpeg_frame_t *frame = NULL;
+    portENTER_CRITICAL(&frame_mux);
+    for (int i = 0; i < JPEG_POOL_SIZE; ++i){
+        if (!pool[i].refs){
+            frame = &pool[i];
+            frame->refs = 1;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&frame_mux);
+    if (!frame){
+        pool_stats.exhausted++;
+        return NULL;
+    }
+    pool_stats.acquired++;
+
+    size_t want = STREAM_PART_HEADROOM + size + size / 4;
+    want = (want + JPEG_POOL_GRANULE - 1) & ~(JPEG_POOL_GRANULE - 1);
+    // grow to fit, shrink only far past the need so sizes near a step do not churn
+    if (frame->cap < want || frame->cap > want * 4){
+        if (frame->buf && frame->cap > want)
+            pool_stats.shrinks++;
+        else
+            pool_stats.grows++;
+        if (!frame_resize(frame, want, 0) && frame->cap < STREAM_PART_HEADROOM + size){
+            jpeg_frame_release(frame);
+            return NULL;
+        }
+    }
+    frame->len = 0;
+    return frame;
+}
+
+static jpeg_frame_t *frame_finish(jpeg_frame_t *frame, int64_t timestamp){
+    // the part header ends right where the JPEG begins
+    char header[STREAM_PART_HEADROOM];
+    const int header_len = snprintf(header, sizeof(header), _STREAM_PART, frame->len);
+    uint8_t *part = frame->buf + STREAM_PART_HEADROOM - header_len;
+    memcpy(part, header, header_len);
+
+    frame->part = part;
+    frame->part_len = header_len + frame->len;
+    frame->timestamp = timestamp;
+    pool_avg = pool_avg ? (pool_avg * 7 + frame->len) / 8 : frame->len;
+    portENTER_CRITICAL(&frame_mux);
+    frame->id = ++frame_ids;
+    portEXIT_CRITICAL(&frame_mux);
+    return frame;
+}
+
+void jpeg_frame_ref(jpeg_frame_t *frame){
+    portENTER_CRITICAL(&frame_mux);
+    frame->refs++;
+    portEXIT_CRITICAL(&frame_mux);
+}
+
+// the last release hands the slot back to the pool, its buffer stays allocated
+void jpeg_frame_release(jpeg_frame_t *frame){
+    portENTER_CRITICAL(&frame_mux);
+    frame->refs--;
+    portEXIT_CRITICAL(&frame_mux);
+}
+
+static size_t jpeg_sink_write(void *arg, size_t index, const void *data, size_t len){
+    jpeg_frame_t *frame = (jpeg_frame_t *)arg;
+    const size_t need = STREAM_PART_HEADROOM + index + len;
+    if (need > frame->cap){
+        size_t cap = frame->cap ? frame->cap * 2 : JPEG_POOL_GRANULE;
+        while (cap < need)
+            cap *= 2;
+        pool_stats.grows++;
+        if (!frame_resize(frame, cap, frame->len))
+            return 0;
+    }
+    memcpy(frame->buf + STREAM_PART_HEADROOM + index, data, len);
+    frame->len = index + len;
+    return len;
+}
+
+jpeg_frame_t *jpeg_frame_encode(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, int64_t timestamp){
+    jpeg_frame_t *frame = frame_acquire(pool_avg ? pool_avg : width * height / 4);
+    if (!frame)
+        return NULL;
+    if (!fmt2jpg_cb(src, src_len, width, height, format, quality, jpeg_sink_write, frame)){
+        jpeg_frame_release(frame);
+        return NULL;
+    }
+    frame->quality = quality;
+    return frame_finish(frame, timestamp);
+}
+
+jpeg_frame_t *jpeg_frame_copy(const uint8_t *jpeg, size_t len, int64_t timestamp){
+    jpeg_frame_t *frame = frame_acquire(len);
+    if (!frame)
+        return NULL;
+    if (frame->cap < STREAM_PART_HEADROOM + len && !frame_resize(frame, STREAM_PART_HEADROOM + len, 0)){
+        jpeg_frame_release(frame);
+        return NULL;
+    }
+    memcpy(frame->buf + STREAM_PART_HEADROOM, jpeg, len);
+    frame->len = len;
+    frame->quality = 0;
+    return frame_finish(frame, timestamp);
+}
+
+void jpeg_pool_get_stats(jpeg_pool_stats_t *out){
+    *out = pool_stats;
+    out->capacity = 0;
+    out->in_use = 0;
+    for (int i = 0; i < JPEG_POOL_SIZE; ++i){
+        out->capacity += pool[i].cap;
+        if (pool[i].refs)
+            out->in_use++;
+    }
+    out->average = pool_avg;
+}
+
+static bool send_all(int fd, const char *buf, size_t len){
+    while (len){
+        int n = send(fd, buf, len, 0);
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static int lwip_io_writev(int fd, const struct iovec *iov, int count){
+    return lwip_writev(fd, iov, count);
+}
+
+static void delivered(const jpeg_frame_t *frame){
+    stream_rate_delivered(frame->timestamp);
+}
+
+static const stream_io_t lwip_io = {lwip_io_writev, jpeg_frame_ref, jpeg_frame_release, delivered};
+
+static void close_client(stream_client_t *c){
+    c->closing = true;
+    httpd_sess_trigger_close(c->hd, c->out.fd);
+}
+
+// one gather write of at most one send window, the socket is non-blocking so
+// whatever does not fit waits for the next time it is writable
+static void pump(stream_client_t *c){
+    const int n = stream_fanout_pump(&c->out, &lwip_io, STREAM_SEND_WINDOW);
+    if (n < 0){
+        close_client(c);
+        return;
+    }
+    if (n)
+        stream_rate_sent(n);
+}
+
+static void stream_sender(void *arg){
+    while (true){
+        fd_set fds;
+        int maxfd = -1;
+        FD_ZERO(&fds);
+        xSemaphoreTake(clients_lock, portMAX_DELAY);
+        for (int i = 0; i < STREAM_MAX_CLIENTS; ++i){
+            stream_client_t *c = &clients[i];
+            if (!c->in_use || c->closing)
+                continue;
+            if (stream_fanout_ready(&c->out)){
+                FD_SET(c->out.fd, &fds);
+                if (c->out.fd > maxfd)
+                    maxfd = c->out.fd;
+            }
+        }
+        xSemaphoreGive(clients_lock);
+
+        if (maxfd < 0){
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        // bounded so frames published meanwhile are picked up
+        struct timeval tv = {0, 20000};
+        if (select(maxfd + 1, NULL, &fds, NULL, &tv) <= 0)
+            continue;
+
+        xSemaphoreTake(clients_lock, portMAX_DELAY);
+        for (int i = 0; i < STREAM_MAX_CLIENTS; ++i){
+            stream_client_t *c = &clients[i];
+            if (c->in_use && !c->closing && c->out.sending && FD_ISSET(c->out.fd, &fds))
+                pump(c);
+        }
+        xSemaphoreGive(clients_lock);
+    }
+}
+
+// httpd calls this when the session closes, before it closes the socket
+static void stream_client_free(void *ctx){
+    stream_client_t *c = (stream_client_t *)ctx;
+    xSemaphoreTake(clients_lock, portMAX_DELAY);
+    stream_fanout_clear(&c->out, &lwip_io);
+    c->in_use = false;
+    Serial.printf("Stream client %d closed, %u sent, %u skipped\n", c->out.fd, c->out.sent, c->out.skipped);
+    xSemaphoreGive(clients_lock);
+}
+
+esp_err_t stream_broadcast_subscribe(httpd_req_t *req){
+    const int fd = httpd_req_to_sockfd(req);
+    stream_client_t *c = NULL;
+    bool chunked = false;
+    char query[32];
+    char value[8];
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "chunked", value, sizeof(value)) == ESP_OK){
+        chunked = atoi(value) != 0;
+    }
+
+    xSemaphoreTake(clients_lock, portMAX_DELAY);
+    if (!sender_task){
+        xTaskCreate(stream_sender, "stream_send", 4096, NULL, 5, &sender_task);
+    }
+    for (int i = 0; i < STREAM_MAX_CLIENTS; ++i){
+        if (!clients[i].in_use){
+            c = &clients[i];
+            break;
+        }
+    }
+    xSemaphoreGive(clients_lock);
+
+    if (!c){
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    const char *response = stream_fanout_response(chunked);
+    if (!send_all(fd, response, strlen(response))){
+        return ESP_FAIL;
+    }
+    // from here on only the sender writes to the socket, httpd still watches
+    // it for reads and reports the peer going away through free_ctx
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    xSemaphoreTake(clients_lock, portMAX_DELAY);
+    c->hd = req->handle;
+    c->closing = false;
+    stream_fanout_reset(&c->out, fd, chunked);
+    c->in_use = true;
+    xSemaphoreGive(clients_lock);
+
+    req->sess_ctx = c;
+    req->free_ctx = stream_client_free;
+    Serial.printf("Stream client %d connected\n", fd);
+    return ESP_OK;
+}
+
+void stream_broadcast_publish(jpeg_frame_t *frame){
+    uint32_t count = 0;
+    uint32_t behind = 0;
+    xSemaphoreTake(clients_lock, portMAX_DELAY);
+    for (int i = 0; i < STREAM_MAX_CLIENTS; ++i){
+        stream_client_t *c = &clients[i];
+        if (!c->in_use || c->closing)
+            continue;
+        if (stream_fanout_offer(&c->out, frame, &lwip_io))
+            behind++;
+        count++;
+    }
+    xSemaphoreGive(clients_lock);
+    stream_rate_published(count, behind);
+    if (sender_task)
+        xTaskNotifyGive(sender_task);
+}
+
+size_t stream_broadcast_subscribers(){
+    size_t count = 0;
+    for (int i = 0; i < STREAM_MAX_CLIENTS; ++i){
+        if (clients[i].in_use && !clients[i].closing)
+            count++;
+    }
+    return count;
+}
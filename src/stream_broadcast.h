@@ -0,0 +1,57 @@
+#pragma once
+#include "Arduino.h"
+#include "esp_http_server.h"
+#include "esp_camera.h"
+#include "stream_fanout.h"
+
+// Encode-once MJPEG fan-out.
+//
+// The encoder publishes each JPEG once as a refcounted jpeg_frame_t. The
+// stream handler hands the socket to the broadcaster and returns, so the
+// stream server keeps accepting viewers. A single sender task writes to all
+// clients with non-blocking sends, at most STREAM_SEND_WINDOW bytes per client
+// each time its socket is writable. A client holds one frame in flight and one
+// waiting; a client that falls behind skips frames instead of queueing them,
+// so a slow link never slows the encoder or the other viewers. What a client
+// holds and sends lives in stream_fanout, this file owns the sockets, the
+// sender task and the frame pool.
+//
+// Frame buffers keep STREAM_PART_HEADROOM free bytes in front of the JPEG.
+// The multipart part header is written there once per frame, so header and
+// JPEG are contiguous and a part, opening boundary included, goes out with one
+// gather write per send window. /stream sends raw multipart; /stream?chunked=1 wraps every
+// part in HTTP/1.1 chunked framing for proxies that want it.
+//
+// Frames come from a fixed pool. The encoder writes through fmt2jpg_cb straight
+// into a pooled buffer, which grows when a frame does not fit and shrinks when
+// it is far larger than the running average, and the last release hands the
+// slot back. Every client holds at most the frame it is sending plus the
+// newest one, the encoder fills one more and the /capture cache holds one
+// while a replacement is encoded, so JPEG_POOL_SIZE slots are never all busy
+// and steady-state streaming does not allocate.
+
+#define STREAM_MAX_CLIENTS 4
+#define JPEG_POOL_SIZE (STREAM_MAX_CLIENTS + 4)
+#define JPEG_POOL_GRANULE 4096
+
+typedef struct {
+    uint32_t acquired;
+    uint32_t exhausted; //encodes dropped because every slot was in flight
+    uint32_t grows;
+    uint32_t shrinks;
+    uint32_t in_use;
+    uint32_t capacity;  //bytes held by the pool
+    uint32_t average;   //running average JPEG size
+} jpeg_pool_stats_t;
+
+// Encode or copy into a pooled frame with one reference, NULL on failure.
+// jpeg_frame_encode takes the same arguments as fmt2jpg.
+jpeg_frame_t *jpeg_frame_encode(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, int64_t timestamp);
+jpeg_frame_t *jpeg_frame_copy(const uint8_t *jpeg, size_t len, int64_t timestamp);
+void jpeg_frame_ref(jpeg_frame_t *frame);
+void jpeg_frame_release(jpeg_frame_t *frame);
+void jpeg_pool_get_stats(jpeg_pool_stats_t *out);
+
+esp_err_t stream_broadcast_subscribe(httpd_req_t *req);
+void stream_broadcast_publish(jpeg_frame_t *frame);
+size_t stream_broadcast_subscribers();
@@ -0,0 +1,117 @@
+#include "stream_fanout.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PART_BOUNDARY "123456789000000000000987654321"
+#define STREAM_RESPONSE_HEAD "HTTP/1.1 200 OK\r\n" \
+                             "Content-Type: multipart/x-mixed-replace;boundary=" PART_BOUNDARY "\r\n" \
+                             "Access-Control-Allow-Origin: *\r\n" \
+                             "Cache-Control: no-cache\r\n" \
+                             "Connection: close\r\n"
+static const char* _STREAM_RESPONSE = STREAM_RESPONSE_HEAD "\r\n";
+static const char* _STREAM_RESPONSE_CHUNKED = STREAM_RESPONSE_HEAD "Transfer-Encoding: chunked\r\n\r\n";
+static const char* _STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
+static const char* _STREAM_CHUNK_END = "\r\n";
+
+const char *stream_fanout_response(bool chunked){
+    return chunked ? _STREAM_RESPONSE_CHUNKED : _STREAM_RESPONSE;
+}
+
+void stream_fanout_reset(stream_fanout_t *c, int fd, bool chunked){
+    c->fd = fd;
+    c->chunked = chunked;
+    c->sending = NULL;
+    c->next = NULL;
+    c->offset = 0;
+    c->part_len = 0;
+    c->chunk_len = 0;
+    c->sent = 0;
+    c->skipped = 0;
+}
+
+void stream_fanout_clear(stream_fanout_t *c, const stream_io_t *io){
+    if (c->sending)
+        io->release(c->sending);
+    if (c->next)
+        io->release(c->next);
+    c->sending = NULL;
+    c->next = NULL;
+}
+
+bool stream_fanout_offer(stream_fanout_t *c, jpeg_frame_t *frame, const stream_io_t *io){
+    // a client still busy with an older frame skips the one it had waiting
+    const bool skipped = c->next != NULL;
+    if (skipped){
+        io->release(c->next);
+        c->skipped++;
+    }
+    io->ref(frame);
+    c->next = frame;
+    return skipped;
+}
+
+static void start_part(stream_fanout_t *c){
+    c->sending = c->next;
+    c->next = NULL;
+    c->offset = 0;
+    c->part_len = c->sending->part_len + strlen(_STREAM_BOUNDARY);
+    c->chunk_len = 0;
+    if (c->chunked){
+        c->chunk_len = snprintf(c->chunk_head, sizeof(c->chunk_head), "%x\r\n", (unsigned)c->part_len);
+        c->part_len += c->chunk_len + 2;
+    }
+}
+
+bool stream_fanout_ready(stream_fanout_t *c){
+    if (!c->sending && c->next)
+        start_part(c);
+    return c->sending != NULL;
+}
+
+// the part is chunk size (chunked only), the boundary that opens it, part
+// header with JPEG, and the chunk end (chunked only). The boundary goes first
+// so the first frame after the response head is a part and not the preamble.
+// Fills iov with what is left of it, at most window bytes
+static int part_iov(stream_fanout_t *c, struct iovec *iov, size_t window){
+    const char *seg[4] = {c->chunk_head, _STREAM_BOUNDARY, (const char *)c->sending->part, _STREAM_CHUNK_END};
+    const size_t seg_len[4] = {c->chunk_len, strlen(_STREAM_BOUNDARY), c->sending->part_len, c->chunked ? strlen(_STREAM_CHUNK_END) : 0};
+    size_t offset = c->offset;
+    int n = 0;
+    for (int i = 0; i < 4 && window; ++i){
+        if (offset >= seg_len[i]){
+            offset -= seg_len[i];
+            continue;
+        }
+        size_t len = seg_len[i] - offset;
+        if (len > window)
+            len = window;
+        iov[n].iov_base = (void *)(seg[i] + offset);
+        iov[n].iov_len = len;
+        n++;
+        window -= len;
+        offset = 0;
+    }
+    return n;
+}
+
+int stream_fanout_pump(stream_fanout_t *c, const stream_io_t *io, size_t window){
+    if (!stream_fanout_ready(c))
+        return 0;
+    struct iovec iov[4];
+    const int count = part_iov(c, iov, window);
+    const int n = io->gather_write(c->fd, iov, count);
+    if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    c->offset += n;
+    if (c->offset == c->part_len){
+        if (io->delivered)
+            io->delivered(c->sending);
+        io->release(c->sending);
+        c->sending = NULL;
+        c->sent++;
+        if (c->next)
+            start_part(c);
+    }
+    return n;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#ifdef ARDUINO
+#include "lwip/sockets.h"
+#else
+#include <sys/uio.h>
+#endif
+
+// Per-client part of the MJPEG fan-out, apart from httpd and the sender task.
+//
+// A client holds one frame in flight and one waiting. Offering a frame while
+// one is still waiting releases the waiting one and counts it as skipped, so a
+// stalled reader falls behind by frames, never by a queue. Pumping writes what
+// is left of the current part with one gather write of at most a send window
+// and starts the waiting frame once the part is out. The socket calls and the
+// frame references go through stream_io_t, so the logic runs the same against
+// lwip and the frame pool on the board and against a socketpair on a host
+// (test/native/test_stream_fanout).
+
+#define STREAM_SEND_WINDOW 4096
+#define STREAM_PART_HEADROOM 64
+
+typedef struct {
+    uint8_t *buf;    //allocation, the JPEG starts at buf + STREAM_PART_HEADROOM
+    size_t len;      //JPEG bytes
+    const uint8_t *part; //part header followed by the JPEG
+    size_t part_len;
+    uint32_t id;     //generation, unique across all frames
+    int64_t timestamp;
+    uint8_t quality; //0 for a copy of a sensor JPEG
+    uint32_t refs;
+    size_t cap;      //allocated bytes of buf, kept across uses of the slot
+} jpeg_frame_t;
+
+typedef struct {
+    // non-blocking gather write, -1 with errno EAGAIN when the socket is full
+    int (*gather_write)(int fd, const struct iovec *iov, int count);
+    void (*ref)(jpeg_frame_t *frame);
+    void (*release)(jpeg_frame_t *frame);
+    void (*delivered)(const jpeg_frame_t *frame); //last byte of a part written, may be NULL
+} stream_io_t;
+
+typedef struct {
+    int fd;
+    bool chunked;
+    jpeg_frame_t *sending;
+    jpeg_frame_t *next; //newest frame not started yet, replaced when a newer one arrives
+    size_t offset; //bytes of the current part already written
+    size_t part_len; //chunk framing included
+    char chunk_head[12];
+    size_t chunk_len;
+    uint32_t sent;
+    uint32_t skipped;
+} stream_fanout_t;
+
+void stream_fanout_reset(stream_fanout_t *c, int fd, bool chunked);
+// releases the frames the client still holds
+void stream_fanout_clear(stream_fanout_t *c, const stream_io_t *io);
+// takes a reference to frame as the waiting one, true when an older waiting
+// frame was skipped for it
+bool stream_fanout_offer(stream_fanout_t *c, jpeg_frame_t *frame, const stream_io_t *io);
+// starts the waiting frame when idle, true when there is a part to send
+bool stream_fanout_ready(stream_fanout_t *c);
+// bytes written, 0 when the socket was full, -1 when the client is gone
+int stream_fanout_pump(stream_fanout_t *c, const stream_io_t *io, size_t window);
+
+// response head for a new client
+const char *stream_fanout_response(bool chunked);
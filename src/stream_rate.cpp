@@ -0,0 +1,143 @@
+#include "stream_rate.h"
+#include "esp_timer.h"
+
+static portMUX_TYPE rate_mux = portMUX_INITIALIZER_UNLOCKED;
+// adaptive, quality 20, every frame, 250 kB/s and 200 ms targets
+static stream_rate_t rate = {true, 20, 1, 0, 250000, 0, 200, 0, 0, 0};
+static uint8_t fixed_quality = 20;
+
+// accumulated since the last update, guarded by rate_mux
+static uint32_t offered = 0;
+static int64_t last_offer = 0;
+static uint64_t offer_interval_sum = 0;
+static uint32_t offer_intervals = 0;
+static uint64_t bytes = 0;
+static uint64_t latency_sum = 0;
+static uint32_t parts = 0;
+static uint32_t deliveries = 0;
+static uint32_t late = 0;
+static uint64_t encode_sum = 0;
+static uint32_t encodes = 0;
+static int64_t period_start = 0;
+
+bool stream_rate_offer(){
+    const int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&rate_mux);
+    if (last_offer){
+        offer_interval_sum += now - last_offer;
+        offer_intervals++;
+    }
+    last_offer = now;
+    const bool take = ++offered >= rate.decimation;
+    if (take)
+        offered = 0;
+    portEXIT_CRITICAL(&rate_mux);
+    return take;
+}
+
+uint8_t stream_rate_quality(){
+    return rate.quality;
+}
+
+void stream_rate_published(uint32_t clients, uint32_t behind){
+    portENTER_CRITICAL(&rate_mux);
+    deliveries += clients;
+    late += behind;
+    portEXIT_CRITICAL(&rate_mux);
+}
+
+void stream_rate_sent(size_t n){
+    portENTER_CRITICAL(&rate_mux);
+    bytes += n;
+    portEXIT_CRITICAL(&rate_mux);
+}
+
+void stream_rate_delivered(int64_t timestamp){
+    const int64_t age = esp_timer_get_time() - timestamp;
+    portENTER_CRITICAL(&rate_mux);
+    latency_sum += age;
+    parts++;
+    portEXIT_CRITICAL(&rate_mux);
+}
+
+static void update(int64_t now){
+    portENTER_CRITICAL(&rate_mux);
+    const int64_t elapsed = now - period_start;
+    rate.bps = bytes * 1000000 / elapsed;
+    rate.latency_ms = parts ? latency_sum / parts / 1000 : 0;
+    rate.encode_us = encodes ? encode_sum / encodes : 0;
+    rate.frame_us = offer_intervals ? offer_interval_sum / offer_intervals : 0;
+    rate.behind = deliveries ? late * 100 / deliveries : 0;
+    bytes = latency_sum = encode_sum = offer_interval_sum = 0;
+    parts = encodes = offer_intervals = deliveries = late = 0;
+    period_start = now;
+    portEXIT_CRITICAL(&rate_mux);
+
+    if (!rate.adaptive){
+        rate.quality = fixed_quality;
+        rate.decimation = 1;
+        return;
+    }
+    // offers arriving while the encoder is busy are dropped unaccounted, so
+    // first make the offered rate one the encoder can take
+    const bool encoder_short = rate.frame_us && rate.encode_us > rate.frame_us * rate.decimation;
+    const bool over = rate.bps > rate.target_bps || rate.latency_ms > rate.target_latency_ms || rate.behind > 25;
+    const bool under = rate.bps * 10 < rate.target_bps * 8 && rate.latency_ms * 10 < rate.target_latency_ms * 7 && !rate.behind;
+
+    if (encoder_short && rate.decimation < STREAM_RATE_MAX_DECIMATION){
+        rate.decimation++;
+    } else if (over){
+        // multiplicative decrease, additive increase
+        const uint8_t step = rate.quality / 4 > 2 ? rate.quality / 4 : 2;
+        if (rate.quality > STREAM_RATE_Q_MIN)
+            rate.quality = rate.quality - step > STREAM_RATE_Q_MIN ? rate.quality - step : STREAM_RATE_Q_MIN;
+        else if (rate.decimation < STREAM_RATE_MAX_DECIMATION)
+            rate.decimation++;
+    } else if (under){
+        if (rate.decimation > 1 && rate.encode_us < rate.frame_us * (rate.decimation - 1))
+            rate.decimation--;
+        else if (rate.quality < STREAM_RATE_Q_MAX)
+            rate.quality += 2;
+    }
+}
+
+void stream_rate_encoded(uint32_t encode_us){
+    const int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&rate_mux);
+    encode_sum += encode_us;
+    encodes++;
+    if (!period_start)
+        period_start = now;
+    portEXIT_CRITICAL(&rate_mux);
+    if (now - period_start >= STREAM_RATE_PERIOD_US)
+        update(now);
+}
+
+void stream_rate_get(stream_rate_t *out){
+    *out = rate;
+}
+
+void stream_rate_set_adaptive(bool adaptive){
+    rate.adaptive = adaptive;
+    if (!adaptive){
+        rate.quality = fixed_quality;
+        rate.decimation = 1;
+    }
+}
+
+void stream_rate_set_quality(uint8_t quality){
+    if (quality < STREAM_RATE_Q_MIN)
+        quality = STREAM_RATE_Q_MIN;
+    if (quality > STREAM_RATE_Q_MAX)
+        quality = STREAM_RATE_Q_MAX;
+    fixed_quality = quality;
+    if (!rate.adaptive)
+        rate.quality = quality;
+}
+
+void stream_rate_set_targets(uint32_t bps, uint32_t latency_ms){
+    if (bps)
+        rate.target_bps = bps;
+    if (latency_ms)
+        rate.target_latency_ms = latency_ms;
+}
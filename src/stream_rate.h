@@ -0,0 +1,48 @@
+#pragma once
+#include "Arduino.h"
+
+// Closed-loop JPEG quality and frame decimation for /stream.
+//
+// The sender reports bytes written and the age of every part when its last
+// byte left, the broadcaster reports how many clients still had a frame
+// waiting when a new one was published, and the encoder reports its encode
+// time. Every STREAM_RATE_PERIOD_US the controller lowers the quality (and
+// past STREAM_RATE_Q_MIN raises the decimation) while the stream is over its
+// bandwidth or latency target or clients fall behind, and creeps back up once
+// everything is comfortably below target.
+//
+// The detector is never slowed down: the encoder runs on the other core and
+// holds at most one of the two frame buffers. The controller only lowers that
+// cost, and raises the decimation when the encoder cannot keep up with the
+// frames offered to it.
+
+#define STREAM_RATE_Q_MIN 10
+#define STREAM_RATE_Q_MAX 90
+#define STREAM_RATE_MAX_DECIMATION 8
+#define STREAM_RATE_PERIOD_US 500000
+
+typedef struct {
+    bool adaptive;
+    uint8_t quality;
+    uint8_t decimation;         //stream every Nth captured frame
+    uint32_t bps;               //bytes per second written to all clients
+    uint32_t target_bps;
+    uint32_t latency_ms;        //encode start to last byte sent
+    uint32_t target_latency_ms;
+    uint32_t encode_us;
+    uint32_t frame_us;          //capture interval seen by the encoder
+    uint32_t behind;            //percent of deliveries that replaced a waiting frame
+} stream_rate_t;
+
+// called by loop() for every captured frame, false when decimation skips it
+bool stream_rate_offer();
+uint8_t stream_rate_quality();
+void stream_rate_encoded(uint32_t encode_us);
+void stream_rate_published(uint32_t clients, uint32_t behind);
+void stream_rate_sent(size_t bytes);
+void stream_rate_delivered(int64_t timestamp);
+
+void stream_rate_get(stream_rate_t *out);
+void stream_rate_set_adaptive(bool adaptive);
+void stream_rate_set_quality(uint8_t quality); //fixed quality when not adaptive
+void stream_rate_set_targets(uint32_t bps, uint32_t latency_ms);
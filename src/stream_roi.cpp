@@ -0,0 +1,195 @@
+#include "stream_roi.h"
+
+static portMUX_TYPE roi_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile int mode = ROI_OFF;
+static int size = 64;
+static int pick = -1;
+static bool locked = false;
+static uint32_t lost = 0;
+static uint32_t target = 0; //track id the window follows
+static uint32_t selected = 0; //target if it was seen in the last frame
+static uint32_t cx = 0;
+static uint32_t cy = 0;
+static uint32_t frame_w = 0;
+static uint32_t frame_h = 0;
+
+// packed rows of a narrow crop, only touched by the encoder task
+static uint8_t *crop_buf = NULL;
+static size_t crop_cap = 0;
+
+static inline uint32_t dot_cx(const Dot &d){ return d.x - 1 + d.w / 2; }
+static inline uint32_t dot_cy(const Dot &d){ return d.y + d.h / 2; }
+
+void stream_roi_track(const Dot *dots, size_t count, uint32_t width, uint32_t height){
+    portENTER_CRITICAL(&roi_mux);
+    if (width != frame_w || height != frame_h){
+        frame_w = width;
+        frame_h = height;
+        cx = width / 2;
+        cy = height / 2;
+        locked = false;
+    }
+    const Dot *best = NULL;
+    if (pick >= 0 && (size_t)pick < count){
+        best = &dots[pick];
+    } else if (locked){
+        for (size_t i = 0; i < count && !best; ++i){
+            if (dots[i].id == target)
+                best = &dots[i];
+        }
+    }
+    if (!best && locked){
+        // the track was lost, stay on the dot nearest to where the window was
+        const int32_t gate = size / 2;
+        int32_t best_d = gate * gate;
+        for (size_t i = 0; i < count; ++i){
+            const int32_t dx = dot_cx(dots[i]) - cx;
+            const int32_t dy = dot_cy(dots[i]) - cy;
+            if (dx * dx + dy * dy <= best_d){
+                best_d = dx * dx + dy * dy;
+                best = &dots[i];
+            }
+        }
+    }
+    if (!best && (!locked || lost >= ROI_LOST_FRAMES)){
+        // the legacy detector does not sort its dots by size
+        for (size_t i = 0; i < count; ++i){
+            if (!best || dots[i].w * dots[i].h > best->w * best->h)
+                best = &dots[i];
+        }
+    }
+    if (best){
+        cx = dot_cx(*best);
+        cy = dot_cy(*best);
+        target = best->id;
+        locked = true;
+        lost = 0;
+    } else if (locked){
+        lost++;
+    }
+    selected = best ? best->id : 0;
+    pick = -1;
+    portEXIT_CRITICAL(&roi_mux);
+}
+
+bool stream_roi_get(roi_rect_t *out){
+    portENTER_CRITICAL(&roi_mux);
+    const uint32_t width = frame_w;
+    const uint32_t height = frame_h;
+    uint32_t w = size < (int)width ? size & ~7 : width;
+    uint32_t h = (w * 3 / 4) & ~7;
+    if (h > height)
+        h = height;
+    int32_t x = (int32_t)cx - (int32_t)w / 2;
+    int32_t y = (int32_t)cy - (int32_t)h / 2;
+    portEXIT_CRITICAL(&roi_mux);
+
+    if (!width || !height)
+        return false;
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (x + w > width) x = width - w;
+    if (y + h > height) y = height - h;
+    out->x = x & ~1; //YUV422 pixels come in pairs
+    out->y = y;
+    out->w = w;
+    out->h = h;
+    return true;
+}
+
+static jpeg_frame_t *encode_crop(camera_fb_t *fb, uint32_t bpp, const roi_rect_t &r, uint8_t quality, int64_t timestamp){
+    const size_t stride = fb->width * bpp;
+    const size_t row = r.w * bpp;
+    if (r.w == fb->width){
+        // whole rows are contiguous in the frame buffer
+        return jpeg_frame_encode(fb->buf + r.y * stride, r.h * stride, r.w, r.h, fb->format, quality, timestamp);
+    }
+    const size_t need = row * r.h;
+    if (need > crop_cap){
+        mem_budget_free(crop_buf);
+        crop_buf = (uint8_t *)mem_budget_malloc(MEM_STAGE_STREAM, need, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (!crop_buf)
+            crop_buf = (uint8_t *)mem_budget_malloc(MEM_STAGE_STREAM, need, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        crop_cap = crop_buf ? need : 0;
+        if (!crop_buf)
+            return NULL;
+    }
+    const uint8_t *src = fb->buf + r.y * stride + r.x * bpp;
+    for (uint32_t y = 0; y < r.h; ++y)
+        memcpy(crop_buf + y * row, src + y * stride, row);
+    return jpeg_frame_encode(crop_buf, need, r.w, r.h, fb->format, quality, timestamp);
+}
+
+// fills every block outside the window with its first pixel, in place
+static void flatten_background(camera_fb_t *fb, uint32_t bpp, const roi_rect_t &r){
+    const uint32_t width = fb->width;
+    const uint32_t height = fb->height;
+    const size_t stride = width * bpp;
+    const uint32_t unit = fb->format == PIXFORMAT_YUV422 ? 4 : bpp; //YUYV pair
+    for (uint32_t by = 0; by < height; by += ROI_INSET_BLOCK){
+        const uint32_t bh = height - by < ROI_INSET_BLOCK ? height - by : ROI_INSET_BLOCK;
+        const bool rows_hit = by < (uint32_t)r.y + r.h && by + bh > r.y;
+        for (uint32_t bx = 0; bx < width; bx += ROI_INSET_BLOCK){
+            const uint32_t bw = width - bx < ROI_INSET_BLOCK ? width - bx : ROI_INSET_BLOCK;
+            if (rows_hit && bx < (uint32_t)r.x + r.w && bx + bw > r.x)
+                continue;
+            uint8_t *block = fb->buf + by * stride + bx * bpp;
+            if (unit == 4)
+                block[2] = block[0];
+            for (uint32_t i = unit; i + unit <= bw * bpp; i += unit)
+                memcpy(block + i, block, unit);
+            for (uint32_t y = 1; y < bh; ++y)
+                memcpy(block + y * stride, block, bw * bpp);
+        }
+    }
+}
+
+bool stream_roi_encode(camera_fb_t *fb, uint8_t quality, int64_t timestamp, jpeg_frame_t **out){
+    const int m = mode;
+    const uint32_t bpp = frame_bpp(fb->format);
+    roi_rect_t r;
+    if (m == ROI_OFF || !bpp || fb->width != frame_w || fb->height != frame_h || !stream_roi_get(&r))
+        return false;
+    if (m == ROI_CROP){
+        *out = encode_crop(fb, bpp, r, quality, timestamp);
+    } else {
+        flatten_background(fb, bpp, r);
+        *out = jpeg_frame_encode(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, timestamp);
+    }
+    return true;
+}
+
+void stream_roi_set_mode(int m){
+    if (m < ROI_OFF || m > ROI_INSET)
+        return;
+    portENTER_CRITICAL(&roi_mux);
+    mode = m;
+    locked = false;
+    portEXIT_CRITICAL(&roi_mux);
+}
+
+int stream_roi_mode(){
+    return mode;
+}
+
+void stream_roi_set_size(int width){
+    if (width < ROI_MIN_SIZE)
+        width = ROI_MIN_SIZE;
+    portENTER_CRITICAL(&roi_mux);
+    size = width;
+    portEXIT_CRITICAL(&roi_mux);
+}
+
+int stream_roi_size(){
+    return size;
+}
+
+uint32_t stream_roi_selected(){
+    return selected;
+}
+
+void stream_roi_pick(int index){
+    portENTER_CRITICAL(&roi_mux);
+    pick = index;
+    portEXIT_CRITICAL(&roi_mux);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "definations.h"
+#include "esp_camera.h"
+#include "stream_broadcast.h"
+
+// Region-of-interest stream around the tracked dot.
+//
+// loop() feeds every frame's dots to stream_roi_track(), whatever the mode, so
+// the selected target is also known to the /dots results. The window follows
+// one track id; it starts on the largest dot, or on the one picked with
+// stream_roi_pick(). When the track is lost it moves to the dot nearest to its
+// last center, and to the largest after ROI_LOST_FRAMES frames with no dot in
+// reach.
+//
+// ROI_CROP encodes only the window. A window spanning the full frame width is
+// handed to the encoder straight from the frame buffer; a narrower one has its
+// rows packed into a small internal buffer first, because fmt2jpg takes no row
+// stride. ROI_INSET keeps the full frame but flattens every ROI_INSET_BLOCK
+// block outside the window to one color in the frame buffer, which JPEG codes
+// with little more than a DC term, so the rate controller can spend the link
+// on the window. Raw RGB888, RGB565, YUV422 and grayscale frames only.
+
+#define ROI_OFF 0
+#define ROI_CROP 1
+#define ROI_INSET 2
+
+#define ROI_MIN_SIZE 32
+#define ROI_INSET_BLOCK 16
+#define ROI_LOST_FRAMES 15
+
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+} roi_rect_t;
+
+void stream_roi_track(const Dot *dots, size_t count, uint32_t width, uint32_t height);
+
+// Encodes fb for the current mode into *out. Returns false when the ROI mode
+// is off or does not apply to fb, the caller then encodes the full frame.
+bool stream_roi_encode(camera_fb_t *fb, uint8_t quality, int64_t timestamp, jpeg_frame_t **out);
+
+void stream_roi_set_mode(int mode);
+int stream_roi_mode();
+void stream_roi_set_size(int width); //window width, the height follows 4:3
+int stream_roi_size();
+void stream_roi_pick(int index);     //index into the dots of the next frame
+uint32_t stream_roi_selected();      //track id of the target in the last frame, 0 when not seen
+bool stream_roi_get(roi_rect_t *out);
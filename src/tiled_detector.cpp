@@ -0,0 +1,418 @@
+#include "tiled_detector.h"
+#include "background_model.h"
+#include "color_classifier.h"
+#include "morphology.h"
+#include "esp_timer.h"
+
+struct Run{
+    uint16_t x0;
+    uint16_t x1;
+    uint16_t label; //0 when the label table was full
+    uint8_t cls;
+};
+
+struct Blob{
+    uint16_t parent;
+    uint16_t minx;
+    uint16_t miny;
+    uint16_t maxx;
+    uint16_t maxy;
+    uint8_t cls;
+    uint32_t count;
+};
+
+// inclusive pixel rectangle
+struct Window{
+    uint16_t x0;
+    uint16_t y0;
+    uint16_t x1;
+    uint16_t y1;
+};
+
+static tiled_stats_t stats;
+
+enum { FMT_RGB888, FMT_RGB565, FMT_YUV422, FMT_GRAY };
+
+template<int F> struct Pixel;
+
+template<> struct Pixel<FMT_RGB888>{
+    static const uint32_t bpp = 3;
+    static inline uint8_t cls(const uint8_t *p){ return classify(p[0], p[1], p[2]); }
+    static inline uint8_t level(const uint8_t *p){ return background_level(p[0], p[1], p[2]); }
+};
+
+template<> struct Pixel<FMT_RGB565>{
+    static const uint32_t bpp = 2;
+    static inline uint8_t cls(const uint8_t *p){
+        return classify(p[0] & 0xF8, ((p[0] & 0x07) << 5) | ((p[1] & 0xE0) >> 3), (p[1] & 0x1F) << 3);
+    }
+    static inline uint8_t level(const uint8_t *p){
+        return background_level(p[0] & 0xF8, ((p[0] & 0x07) << 5) | ((p[1] & 0xE0) >> 3), (p[1] & 0x1F) << 3);
+    }
+};
+
+// YUYV: the luma of pixel x is byte 2x
+template<> struct Pixel<FMT_YUV422>{
+    static const uint32_t bpp = 2;
+    static inline uint8_t cls(const uint8_t *p){ return classify(p[0], p[0], p[0]); }
+    static inline uint8_t level(const uint8_t *p){ return p[0]; }
+};
+
+template<> struct Pixel<FMT_GRAY>{
+    static const uint32_t bpp = 1;
+    static inline uint8_t cls(const uint8_t *p){ return classify(p[0], p[0], p[0]); }
+    static inline uint8_t level(const uint8_t *p){ return p[0]; }
+};
+
+// the class of a hit that stands out from the background model, 0 for none;
+// bg NULL when the model is off
+template<int F>
+static inline uint8_t foreground(const uint8_t *p, uint32_t x, const uint8_t *bg, uint8_t margin){
+    const uint8_t c = Pixel<F>::cls(p);
+    return c && background_foreground(bg, x, Pixel<F>::level(p), margin) ? c : 0;
+}
+
+static inline uint16_t find_root(Blob *blobs, uint16_t l){
+    while (blobs[l].parent != l){
+        blobs[l].parent = blobs[blobs[l].parent].parent;
+        l = blobs[l].parent;
+    }
+    return l;
+}
+
+static void unite(Blob *blobs, uint16_t a, uint16_t b){
+    a = find_root(blobs, a);
+    b = find_root(blobs, b);
+    if (a == b)
+        return;
+    if (b < a){
+        uint16_t t = a;
+        a = b;
+        b = t;
+    }
+    Blob &ra = blobs[a];
+    const Blob &rb = blobs[b];
+    blobs[b].parent = a;
+    if (rb.minx < ra.minx) ra.minx = rb.minx;
+    if (rb.miny < ra.miny) ra.miny = rb.miny;
+    if (rb.maxx > ra.maxx) ra.maxx = rb.maxx;
+    if (rb.maxy > ra.maxy) ra.maxy = rb.maxy;
+    ra.count += rb.count;
+}
+
+// row holds columns x0 .. x0 + width - 1
+template<int F>
+static size_t IRAM_ATTR row_runs(const uint8_t *row, uint32_t x0, uint32_t width, Run *runs, const uint8_t *bg, uint8_t margin){
+    size_t n = 0;
+    uint32_t x = 0;
+    while (x < width){
+        const uint8_t c = foreground<F>(row + x * Pixel<F>::bpp, x0 + x, bg, margin);
+        if (!c){
+            ++x;
+            continue;
+        }
+        // a run is one class, a neighbour of another class starts a new one
+        const uint32_t start = x;
+        while (x < width && foreground<F>(row + x * Pixel<F>::bpp, x0 + x, bg, margin) == c)
+            ++x;
+        if (n == TILED_MAX_RUNS){
+            stats.run_overflows++;
+            continue;
+        }
+        runs[n].x0 = x0 + start;
+        runs[n].x1 = x0 + x - 1;
+        runs[n].label = 0;
+        runs[n].cls = c;
+        n++;
+    }
+    return n;
+}
+
+static inline void connect(Blob *blobs, Run &r, const Run &other){
+    if (!other.label || other.cls != r.cls)
+        return;
+    if (!r.label)
+        r.label = other.label;
+    else
+        unite(blobs, r.label, other.label);
+}
+
+// labels the pixels of win into blobs, continuing from next_label
+template<int F>
+static uint16_t IRAM_ATTR label_window(camera_fb_t *fb, const Window &win, bool use_bg, Run *rows, Blob *blobs, uint8_t *band, uint16_t next_label){
+    const uint32_t stride = fb->width * Pixel<F>::bpp;
+    const uint32_t width = win.x1 - win.x0 + 1;
+    const uint32_t row_bytes = width * Pixel<F>::bpp;
+    const uint8_t margin = background_margin();
+    size_t row_count[SEARCH_RADIUS + 1] = {0};
+
+    for (uint32_t y0 = win.y0; y0 <= win.y1; y0 += TILED_BAND_ROWS){
+        const uint32_t band_rows = win.y1 + 1 - y0 < TILED_BAND_ROWS ? win.y1 + 1 - y0 : TILED_BAND_ROWS;
+        if (row_bytes == stride){
+            memcpy(band, fb->buf + y0 * stride, band_rows * stride);
+        } else {
+            for (uint32_t r = 0; r < band_rows; ++r)
+                memcpy(band + r * row_bytes, fb->buf + (y0 + r) * stride + win.x0 * Pixel<F>::bpp, row_bytes);
+        }
+        stats.bands++;
+
+        for (uint32_t r = 0; r < band_rows; ++r){
+            const uint32_t y = y0 + r;
+            Run *cur = rows + (y % (SEARCH_RADIUS + 1)) * TILED_MAX_RUNS;
+            const size_t n = row_runs<F>(band + r * row_bytes, win.x0, width, cur, use_bg ? background_row(y) : NULL, margin);
+            row_count[y % (SEARCH_RADIUS + 1)] = n;
+            stats.runs += n;
+
+            // runs of the previous rows may sit in the previous band, this is
+            // where blobs are stitched across band borders
+            size_t first[SEARCH_RADIUS];
+            for (int k = 0; k < SEARCH_RADIUS; ++k)
+                first[k] = 0;
+
+            for (size_t i = 0; i < n; ++i){
+                Run &run = cur[i];
+                if (i > 0 && run.x0 <= cur[i - 1].x1 + SEARCH_RADIUS)
+                    connect(blobs, run, cur[i - 1]);
+                for (int k = 0; k < SEARCH_RADIUS && (uint32_t)k < y - win.y0; ++k){
+                    const uint32_t py = y - 1 - k;
+                    const Run *prev = rows + (py % (SEARCH_RADIUS + 1)) * TILED_MAX_RUNS;
+                    const size_t m = row_count[py % (SEARCH_RADIUS + 1)];
+                    size_t j = first[k];
+                    while (j < m && prev[j].x1 + SEARCH_RADIUS < run.x0)
+                        ++j;
+                    first[k] = j;
+                    for (; j < m && prev[j].x0 <= run.x1 + SEARCH_RADIUS; ++j)
+                        connect(blobs, run, prev[j]);
+                }
+                if (!run.label){
+                    if (next_label == TILED_MAX_LABELS){
+                        stats.label_overflows++;
+                        continue;
+                    }
+                    run.label = next_label;
+                    Blob &b = blobs[next_label];
+                    b.parent = next_label;
+                    b.minx = run.x0;
+                    b.maxx = run.x1;
+                    b.miny = y;
+                    b.maxy = y;
+                    b.cls = run.cls;
+                    b.count = 0;
+                    next_label++;
+                }
+                Blob &root = blobs[find_root(blobs, run.label)];
+                if (run.x0 < root.minx) root.minx = run.x0;
+                if (run.x1 > root.maxx) root.maxx = run.x1;
+                if (y < root.miny) root.miny = y;
+                if (y > root.maxy) root.maxy = y;
+                root.count += run.x1 - run.x0 + 1;
+            }
+        }
+    }
+    return next_label;
+}
+
+static inline bool windows_near(const Window &a, const Window &b){
+    return a.x0 <= b.x1 + SEARCH_RADIUS + 1 && b.x0 <= a.x1 + SEARCH_RADIUS + 1 &&
+           a.y0 <= b.y1 + SEARCH_RADIUS + 1 && b.y0 <= a.y1 + SEARCH_RADIUS + 1;
+}
+
+// Marks the cells that hold a hit, groups touching cells into boxes and turns
+// each box into a window. Every hit lies in a marked cell, so a blob lies in
+// the window of its cells; windows close enough to share a blob are merged,
+// so no blob is split or labeled twice. False when the windows would not save
+// anything over the whole frame.
+template<int F>
+static bool IRAM_ATTR coarse_windows(camera_fb_t *fb, uint32_t step, bool use_bg, uint8_t *line, uint32_t *cells, Window *windows, size_t &count){
+    const uint32_t width = fb->width;
+    const uint32_t height = fb->height;
+    const uint32_t stride = width * Pixel<F>::bpp;
+    const uint32_t cols = (width + step - 1) / step;
+    const uint32_t rows = (height + step - 1) / step;
+    const uint32_t words = (cols + 31) / 32;
+    const uint8_t margin = background_margin();
+    count = 0;
+
+    for (uint32_t cy = 0; cy < rows; ++cy){
+        uint32_t *row = cells + cy * words;
+        memset(row, 0, words * sizeof(uint32_t));
+        // max pool: the cell row ORs the hits of all its pixel rows
+        const uint32_t y_end = (cy + 1) * step < height ? (cy + 1) * step : height;
+        for (uint32_t y = cy * step; y < y_end; ++y){
+            memcpy(line, fb->buf + y * stride, stride);
+            const uint8_t *bg = use_bg ? background_row(y) : NULL;
+            uint32_t x = 0;
+            while (x < width){
+                const uint32_t cx = x / step;
+                if ((row[cx >> 5] >> (cx & 31)) & 1){
+                    // a marked cell is not looked at again
+                    x = (cx + 1) * step;
+                    continue;
+                }
+                if (foreground<F>(line + x * Pixel<F>::bpp, x, bg, margin))
+                    row[cx >> 5] |= 1u << (cx & 31);
+                ++x;
+            }
+        }
+
+        for (uint32_t cx = morph_next_set(row, 0, cols); cx < cols; ){
+            const uint32_t end = morph_next_clear(row, cx, cols);
+            size_t i = 0;
+            while (i < count && !((uint32_t)windows[i].y1 + 1 >= cy && windows[i].x0 <= end && (uint32_t)windows[i].x1 + 1 >= cx))
+                ++i;
+            if (i < count){
+                Window &b = windows[i];
+                if (cx < b.x0) b.x0 = cx;
+                if (end - 1 > b.x1) b.x1 = end - 1;
+                b.y1 = cy;
+            } else if (count < TILED_MAX_WINDOWS){
+                windows[count++] = {(uint16_t)cx, (uint16_t)cy, (uint16_t)(end - 1), (uint16_t)cy};
+            } else {
+                return false;
+            }
+            cx = morph_next_set(row, end, cols);
+        }
+    }
+
+    // cells to pixels
+    for (size_t i = 0; i < count; ++i){
+        Window &b = windows[i];
+        const uint32_t x1 = (b.x1 + 1) * step;
+        const uint32_t y1 = (b.y1 + 1) * step;
+        b.x0 = b.x0 * step;
+        b.y0 = b.y0 * step;
+        b.x1 = (x1 < width ? x1 : width) - 1;
+        b.y1 = (y1 < height ? y1 : height) - 1;
+    }
+    bool merged = true;
+    while (merged){
+        merged = false;
+        for (size_t i = 0; i < count; ++i){
+            for (size_t j = i + 1; j < count; ++j){
+                if (!windows_near(windows[i], windows[j]))
+                    continue;
+                Window &a = windows[i];
+                const Window &b = windows[j];
+                if (b.x0 < a.x0) a.x0 = b.x0;
+                if (b.y0 < a.y0) a.y0 = b.y0;
+                if (b.x1 > a.x1) a.x1 = b.x1;
+                if (b.y1 > a.y1) a.y1 = b.y1;
+                windows[j--] = windows[--count];
+                merged = true;
+            }
+        }
+    }
+
+    uint32_t area = 0;
+    for (size_t i = 0; i < count; ++i)
+        area += (windows[i].x1 - windows[i].x0 + 1) * (windows[i].y1 - windows[i].y0 + 1);
+    return area * 2 <= width * height;
+}
+
+template<int F>
+static uint16_t label_frame(camera_fb_t *fb, uint8_t coarse, bool use_bg, Run *rows, Blob *blobs, uint8_t *band){
+    Window windows[TILED_MAX_WINDOWS];
+    size_t count = 0;
+    bool windowed = false;
+    stats.coarse_us = 0;
+    if (coarse > 1){
+        const int64_t start = esp_timer_get_time();
+        const uint32_t cols = (fb->width + coarse - 1) / coarse;
+        const uint32_t cell_rows = (fb->height + coarse - 1) / coarse;
+        const size_t cells_bytes = cell_rows * ((cols + 31) / 32) * sizeof(uint32_t);
+        FrameArena &cells_arena = frame_arena_place(cells_bytes, true);
+        uint32_t *cells = (uint32_t *)cells_arena.alloc(cells_bytes);
+        if (cells)
+            windowed = coarse_windows<F>(fb, coarse, use_bg, band, cells, windows, count);
+        cells_arena.release(cells);
+        stats.coarse_us = esp_timer_get_time() - start;
+    }
+
+    uint16_t next_label = 1;
+    if (!windowed){
+        const Window frame = {0, 0, (uint16_t)(fb->width - 1), (uint16_t)(fb->height - 1)};
+        stats.windows = 0;
+        stats.window_pixels = fb->width * fb->height;
+        return label_window<F>(fb, frame, use_bg, rows, blobs, band, next_label);
+    }
+    stats.windows = count;
+    stats.window_pixels = 0;
+    for (size_t i = 0; i < count; ++i){
+        stats.window_pixels += (windows[i].x1 - windows[i].x0 + 1) * (windows[i].y1 - windows[i].y0 + 1);
+        next_label = label_window<F>(fb, windows[i], use_bg, rows, blobs, band, next_label);
+    }
+    return next_label;
+}
+
+int tiled_detect(camera_fb_t *fb, Dot *out, size_t max, uint8_t coarse, bool background){
+    uint32_t bpp;
+    switch (fb->format){
+        case PIXFORMAT_RGB888: bpp = Pixel<FMT_RGB888>::bpp; break;
+        case PIXFORMAT_RGB565: bpp = Pixel<FMT_RGB565>::bpp; break;
+        case PIXFORMAT_YUV422: bpp = Pixel<FMT_YUV422>::bpp; break;
+        case PIXFORMAT_GRAYSCALE: bpp = Pixel<FMT_GRAY>::bpp; break;
+        default: return -1;
+    }
+    const int64_t start = esp_timer_get_time();
+    const size_t band_bytes = TILED_BAND_ROWS * fb->width * bpp;
+    const size_t rows_bytes = (SEARCH_RADIUS + 1) * TILED_MAX_RUNS * sizeof(Run);
+    const size_t blobs_bytes = TILED_MAX_LABELS * sizeof(Blob);
+    const bool use_bg = background && background_fits(fb->width, fb->height);
+
+    FrameArena &rows_arena = frame_arena_place(rows_bytes, true);
+    Run *rows = (Run *)rows_arena.alloc(rows_bytes);
+    FrameArena &blobs_arena = frame_arena_place(blobs_bytes, true);
+    Blob *blobs = (Blob *)blobs_arena.alloc(blobs_bytes);
+    FrameArena &band_arena = frame_arena_place(band_bytes, true);
+    uint8_t *band = (uint8_t *)band_arena.alloc(band_bytes);
+
+    int found = 0;
+    if (rows && blobs && band){
+        uint16_t labels = 0;
+        switch (fb->format){
+            case PIXFORMAT_RGB888: labels = label_frame<FMT_RGB888>(fb, coarse, use_bg, rows, blobs, band); break;
+            case PIXFORMAT_RGB565: labels = label_frame<FMT_RGB565>(fb, coarse, use_bg, rows, blobs, band); break;
+            case PIXFORMAT_YUV422: labels = label_frame<FMT_YUV422>(fb, coarse, use_bg, rows, blobs, band); break;
+            default: labels = label_frame<FMT_GRAY>(fb, coarse, use_bg, rows, blobs, band); break;
+        }
+
+        // keep the max largest blobs, out stays sorted by pixel count
+        uint32_t counts[DOTS_MAX];
+        if (max > DOTS_MAX)
+            max = DOTS_MAX;
+        for (uint16_t l = 1; l < labels; ++l){
+            const Blob &b = blobs[l];
+            if (b.parent != l)
+                continue;
+            stats.blobs++;
+            int i = found < (int)max ? found++ : (int)max;
+            while (i > 0 && counts[i - 1] < b.count){
+                if (i < (int)max){
+                    counts[i] = counts[i - 1];
+                    out[i] = out[i - 1];
+                }
+                --i;
+            }
+            if (i < (int)max){
+                counts[i] = b.count;
+                out[i].x = b.minx + 1;
+                out[i].y = b.miny;
+                out[i].w = b.maxx - b.minx;
+                out[i].h = b.maxy - b.miny;
+                out[i].id = 0;
+                out[i].cls = b.cls;
+            }
+        }
+    }
+
+    band_arena.release(band);
+    blobs_arena.release(blobs);
+    rows_arena.release(rows);
+    stats.frames++;
+    stats.last_us = esp_timer_get_time() - start;
+    return found;
+}
+
+void tiled_get_stats(tiled_stats_t *out){
+    *out = stats;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "definations.h"
+#include "esp_camera.h"
+
+// Band-wise blob labeling for frames too large for the random-access detector.
+//
+// The frame is walked in bands of TILED_BAND_ROWS rows. Each band is copied
+// out of the PSRAM frame buffer with one memcpy into an internal RAM line
+// buffer, thresholded into horizontal runs and labeled with a union-find table.
+// The runs of the last SEARCH_RADIUS rows are carried over to the next band,
+// so blobs crossing a band border are stitched with the same gap rule the
+// legacy detector uses. Every pixel is read once, so the cost is linear in the
+// frame area. RGB888, RGB565, YUV422 and grayscale frames are supported.
+// Runs and blobs hold one marker class each (see color_classifier.h), so all
+// classes are labeled in the same pass and touching markers of different
+// classes stay apart. Pixels the background model explains are not hits (see
+// background_model.h).
+//
+// With a coarse step the frame is searched coarse to fine. One pass max-pools
+// the hits into a mask of step x step cells, skipping the rest of a cell once
+// it is marked, touching cells are grouped into candidate boxes, and only those
+// boxes are labeled at full resolution. Classifying is all the pass does, the
+// union-find labeling then scales with the number and size of the targets
+// instead of the frame. Every hit lies in a marked cell, so the dots are the
+// same as without the search. The whole frame is labeled instead when there
+// are more than TILED_MAX_WINDOWS candidates or they cover half of it.
+
+#define TILED_BAND_ROWS 8
+#define TILED_MAX_RUNS 128   //per row
+#define TILED_MAX_LABELS 1024
+#define TILED_MAX_WINDOWS 16
+#define TILED_COARSE_STEP 4  //default step, 0 labels the whole frame
+#define TILED_COARSE_MAX 16
+
+typedef struct {
+    uint32_t frames;
+    uint32_t bands;
+    uint32_t runs;
+    uint32_t blobs;
+    uint32_t run_overflows;
+    uint32_t label_overflows;
+    uint32_t windows;       //candidate windows of the last frame, 0 for the whole frame
+    uint32_t window_pixels; //pixels labeled in the last frame
+    uint32_t coarse_us;
+    uint32_t last_us;
+} tiled_stats_t;
+
+// Fills out with up to max dots, largest first, in the legacy Dot convention
+// (x is 1-based). coarse is the coarse search step, 0 or 1 for none; without
+// background the model is not applied. Returns the number of dots, or -1 for
+// unsupported formats.
+int tiled_detect(camera_fb_t *fb, Dot *out, size_t max, uint8_t coarse, bool background);
+void tiled_get_stats(tiled_stats_t *out);
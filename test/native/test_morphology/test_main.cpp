@@ -0,0 +1,191 @@
+#include <unity.h>
+#include <stdlib.h>
+#include <deque>
+#include <vector>
+#include "morphology.h"
+
+// Random masks against brute force: the separable morphology against the
+// square window it stands for, and the run walk of the legacy detector against
+// the pixel BFS it replaced, which joined hits up to 2r + 1 apart.
+
+static int W, H, S;
+
+static bool get(const std::vector<uint32_t> &m, int x, int y){
+    return (m[y * S + (x >> 5)] >> (x & 31)) & 1;
+}
+
+static void set(std::vector<uint32_t> &m, int x, int y){
+    m[y * S + (x >> 5)] |= 1u << (x & 31);
+}
+
+static std::vector<uint32_t> random_mask(int density){
+    std::vector<uint32_t> m(S * H, 0);
+    for (int y = 0; y < H; ++y){
+        for (int x = 0; x < W; ++x){
+            if (rand() % density == 0)
+                set(m, x, y);
+        }
+    }
+    return m;
+}
+
+// every pixel of the (2r + 1)^2 window, outside counted as set for erosion
+static std::vector<uint32_t> brute(const std::vector<uint32_t> &m, int r, bool erode){
+    std::vector<uint32_t> out(m.size(), 0);
+    for (int y = 0; y < H; ++y){
+        for (int x = 0; x < W; ++x){
+            bool v = erode;
+            for (int dy = -r; dy <= r; ++dy){
+                for (int dx = -r; dx <= r; ++dx){
+                    const int xx = x + dx;
+                    const int yy = y + dy;
+                    const bool b = xx < 0 || yy < 0 || xx >= W || yy >= H ? erode : get(m, xx, yy);
+                    v = erode ? v && b : v || b;
+                }
+            }
+            if (v)
+                set(out, x, y);
+        }
+    }
+    return out;
+}
+
+static void test_morphology_matches_brute_force(){
+    srand(1);
+    for (int t = 0; t < 300; ++t){
+        W = 1 + rand() % 100;
+        H = 1 + rand() % 40;
+        S = (W + 31) / 32;
+        const std::vector<uint32_t> m = random_mask(1 + rand() % 10);
+        std::vector<uint32_t> tmp(S * H);
+        const int r = rand() % 7;
+
+        std::vector<uint32_t> d = m;
+        morph_dilate(d.data(), tmp.data(), W, H, S, r);
+        TEST_ASSERT_TRUE(d == brute(m, r, false));
+        std::vector<uint32_t> e = m;
+        morph_erode(e.data(), tmp.data(), W, H, S, r);
+        TEST_ASSERT_TRUE(e == brute(m, r, true));
+        std::vector<uint32_t> o = m;
+        morph_open(o.data(), tmp.data(), W, H, S, r);
+        TEST_ASSERT_TRUE(o == brute(brute(m, r, true), r, false));
+    }
+}
+
+static void test_scanners_match_brute_force(){
+    srand(2);
+    for (int t = 0; t < 200; ++t){
+        W = 1 + rand() % 100;
+        H = 1;
+        S = (W + 31) / 32;
+        const std::vector<uint32_t> m = random_mask(1 + rand() % 4);
+        const uint32_t *row = m.data();
+        for (int x = 0; x < W; ++x){
+            int next_set = x;
+            while (next_set < W && !get(m, next_set, 0))
+                next_set++;
+            int next_clear = x;
+            while (next_clear < W && get(m, next_clear, 0))
+                next_clear++;
+            TEST_ASSERT_EQUAL(next_set, morph_next_set(row, x, W));
+            TEST_ASSERT_EQUAL(next_clear, morph_next_clear(row, x, W));
+            if (get(m, x, 0)){
+                int start = x;
+                while (start > 0 && get(m, start - 1, 0))
+                    start--;
+                TEST_ASSERT_EQUAL(start, morph_run_start(row, x));
+            }
+        }
+    }
+}
+
+struct Queue{
+    std::deque<uint32_t> q;
+
+    bool empty() const {
+        return q.empty();
+    }
+    void clear(){
+        q.clear();
+    }
+    void push(uint32_t x, uint32_t y){
+        q.push_back((y << 16) | x);
+    }
+    void pop(uint32_t &x, uint32_t &y){
+        const uint32_t v = q.front();
+        q.pop_front();
+        x = v & 0xFFFF;
+        y = v >> 16;
+    }
+};
+
+static void test_component_matches_bfs(){
+    srand(3);
+    for (int t = 0; t < 500; ++t){
+        W = 1 + rand() % 90;
+        H = 1 + rand() % 50;
+        S = (W + 31) / 32;
+        const int r = 1 + rand() % 3;
+        const std::vector<uint32_t> hits = random_mask(2 + rand() % 30);
+        std::vector<uint32_t> bridged = hits;
+        std::vector<uint32_t> tmp(S * H);
+        morph_dilate(bridged.data(), tmp.data(), W, H, S, r);
+        std::vector<uint32_t> done(S * H, 0);
+        std::vector<uint32_t> seen(S * H, 0);
+        Queue queue;
+
+        for (int y = 0; y < H; ++y){
+            for (int x = 0; x < W; ++x){
+                if (!get(hits, x, y) || get(done, x, y))
+                    continue;
+                std::vector<uint32_t> want(S * H, 0);
+                int x0 = x, x1 = x, y0 = y, y1 = y;
+                std::deque<std::pair<int, int> > bfs;
+                bfs.push_back(std::make_pair(x, y));
+                set(seen, x, y);
+                set(want, x, y);
+                while (!bfs.empty()){
+                    const int px = bfs.front().first;
+                    const int py = bfs.front().second;
+                    bfs.pop_front();
+                    x0 = px < x0 ? px : x0;
+                    x1 = px > x1 ? px : x1;
+                    y0 = py < y0 ? py : y0;
+                    y1 = py > y1 ? py : y1;
+                    for (int dy = -2 * r - 1; dy <= 2 * r + 1; ++dy){
+                        for (int dx = -2 * r - 1; dx <= 2 * r + 1; ++dx){
+                            const int xx = px + dx;
+                            const int yy = py + dy;
+                            if (xx < 0 || yy < 0 || xx >= W || yy >= H || !get(hits, xx, yy) || get(seen, xx, yy))
+                                continue;
+                            set(seen, xx, yy);
+                            set(want, xx, yy);
+                            bfs.push_back(std::make_pair(xx, yy));
+                        }
+                    }
+                }
+
+                std::vector<uint32_t> before = done;
+                morph_box_t box = {0, 0, 0, 0};
+                TEST_ASSERT_TRUE(morph_component(bridged.data(), hits.data(), done.data(), W, H, S, x, y, queue, &box));
+                TEST_ASSERT_EQUAL(x0, box.x0);
+                TEST_ASSERT_EQUAL(y0, box.y0);
+                TEST_ASSERT_EQUAL(x1, box.x1);
+                TEST_ASSERT_EQUAL(y1, box.y1);
+                for (int i = 0; i < S * H; ++i)
+                    TEST_ASSERT_EQUAL(want[i], done[i] & ~before[i]);
+            }
+        }
+    }
+}
+
+void setUp(){}
+void tearDown(){}
+
+int main(){
+    UNITY_BEGIN();
+    RUN_TEST(test_morphology_matches_brute_force);
+    RUN_TEST(test_scanners_match_brute_force);
+    RUN_TEST(test_component_matches_bfs);
+    return UNITY_END();
+}
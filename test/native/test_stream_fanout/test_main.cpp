@@ -0,0 +1,176 @@
+#include <unity.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+#include "stream_fanout.h"
+
+// A fast reader that drains its socket after every send and a stalled one
+// that never reads share the frames published, like two /stream viewers.
+
+#define FRAMES 40
+#define JPEG_BYTES 20000
+
+static int host_writev(int fd, const struct iovec *iov, int count){
+    return writev(fd, iov, count);
+}
+
+static void ref(jpeg_frame_t *frame){
+    frame->refs++;
+}
+
+static void release(jpeg_frame_t *frame){
+    TEST_ASSERT_TRUE(frame->refs > 0);
+    frame->refs--;
+}
+
+static const stream_io_t host_io = {host_writev, ref, release, NULL};
+
+static jpeg_frame_t frames[FRAMES];
+static std::vector<uint8_t> parts[FRAMES];
+
+static void make_frames(){
+    for (int i = 0; i < FRAMES; ++i){
+        char head[STREAM_PART_HEADROOM];
+        const int head_len = snprintf(head, sizeof(head), "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n", JPEG_BYTES);
+        parts[i].assign(head, head + head_len);
+        parts[i].resize(head_len + JPEG_BYTES, (uint8_t)i);
+        memset(&frames[i], 0, sizeof(frames[i]));
+        frames[i].part = parts[i].data();
+        frames[i].part_len = parts[i].size();
+        frames[i].len = JPEG_BYTES;
+        frames[i].id = i + 1;
+        frames[i].refs = 1; //the publisher's
+    }
+}
+
+static void socket_pair(int fds[2]){
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL, 0) | O_NONBLOCK);
+    const int size = 8192;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
+static size_t drain(int fd, std::vector<uint8_t> &into){
+    uint8_t buf[4096];
+    size_t total = 0;
+    int n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0){
+        into.insert(into.end(), buf, buf + n);
+        total += n;
+    }
+    return total;
+}
+
+// pumps like the sender task until the socket is full or nothing is left
+static void pump_until_blocked(stream_fanout_t *c){
+    int n;
+    while ((n = stream_fanout_pump(c, &host_io, STREAM_SEND_WINDOW)) > 0)
+        TEST_ASSERT_TRUE(n <= STREAM_SEND_WINDOW);
+    TEST_ASSERT_EQUAL(0, n);
+}
+
+static size_t count(const std::vector<uint8_t> &data, const char *what){
+    const size_t len = strlen(what);
+    size_t found = 0;
+    for (size_t i = 0; i + len <= data.size(); ++i){
+        if (!memcmp(&data[i], what, len))
+            found++;
+    }
+    return found;
+}
+
+static void test_stalled_reader_skips_fast_reader_gets_all(){
+    make_frames();
+    int fast_fds[2];
+    int slow_fds[2];
+    socket_pair(fast_fds);
+    socket_pair(slow_fds);
+    stream_fanout_t fast;
+    stream_fanout_t slow;
+    stream_fanout_reset(&fast, fast_fds[0], false);
+    stream_fanout_reset(&slow, slow_fds[0], false);
+    std::vector<uint8_t> fast_got;
+
+    for (int i = 0; i < FRAMES; ++i){
+        stream_fanout_offer(&fast, &frames[i], &host_io);
+        stream_fanout_offer(&slow, &frames[i], &host_io);
+        // the fast reader keeps up: send, read, send until the part is out
+        while (stream_fanout_ready(&fast)){
+            pump_until_blocked(&fast);
+            drain(fast_fds[1], fast_got);
+        }
+        pump_until_blocked(&slow);
+    }
+
+    TEST_ASSERT_EQUAL(FRAMES, fast.sent);
+    TEST_ASSERT_EQUAL(0, fast.skipped);
+    TEST_ASSERT_EQUAL(FRAMES, count(fast_got, "Content-Length"));
+    TEST_ASSERT_EQUAL(FRAMES * (size_t)(parts[0].size() + 36), fast_got.size());
+    // every part opens with the boundary, the first one included
+    TEST_ASSERT_EQUAL(0, memcmp(fast_got.data(), "\r\n--", 4));
+    TEST_ASSERT_EQUAL(FRAMES, count(fast_got, "\r\n--123456789000000000000987654321\r\nContent-Type"));
+
+    // the stalled reader fell behind by frames, not by a queue
+    TEST_ASSERT_TRUE(slow.skipped > 0);
+    TEST_ASSERT_TRUE(slow.sent < FRAMES);
+    TEST_ASSERT_TRUE(slow.sent + slow.skipped + (slow.sending != NULL) + (slow.next != NULL) == FRAMES);
+    for (int i = 0; i < FRAMES - 2; ++i)
+        TEST_ASSERT_TRUE(frames[i].refs <= 2);
+
+    // once it reads again it finishes the part in flight and gets the newest
+    std::vector<uint8_t> slow_got;
+    while (stream_fanout_ready(&slow)){
+        pump_until_blocked(&slow);
+        drain(slow_fds[1], slow_got);
+    }
+    TEST_ASSERT_EQUAL(FRAMES, slow.sent + slow.skipped);
+    TEST_ASSERT_EQUAL((uint8_t)(FRAMES - 1), slow_got[slow_got.size() - 1]);
+
+    stream_fanout_clear(&fast, &host_io);
+    stream_fanout_clear(&slow, &host_io);
+    for (int i = 0; i < FRAMES; ++i)
+        TEST_ASSERT_EQUAL(1, frames[i].refs);
+    close(fast_fds[0]);
+    close(fast_fds[1]);
+    close(slow_fds[0]);
+    close(slow_fds[1]);
+}
+
+static void test_chunked_part_framing(){
+    make_frames();
+    int fds[2];
+    socket_pair(fds);
+    stream_fanout_t c;
+    stream_fanout_reset(&c, fds[0], true);
+    stream_fanout_offer(&c, &frames[0], &host_io);
+    std::vector<uint8_t> got;
+    while (stream_fanout_ready(&c)){
+        pump_until_blocked(&c);
+        drain(fds[1], got);
+    }
+    char head[16];
+    const int head_len = snprintf(head, sizeof(head), "%x\r\n", (unsigned)(parts[0].size() + 36));
+    TEST_ASSERT_EQUAL(head_len + parts[0].size() + 36 + 2, got.size());
+    TEST_ASSERT_EQUAL(0, memcmp(got.data(), head, head_len));
+    TEST_ASSERT_EQUAL(0, memcmp(&got[head_len], "\r\n--", 4));
+    TEST_ASSERT_EQUAL(0, got[got.size() - 3]); //last JPEG byte of frame 0
+    TEST_ASSERT_EQUAL(0, memcmp(&got[got.size() - 2], "\r\n", 2));
+    TEST_ASSERT_EQUAL(1, frames[0].refs);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void setUp(){}
+void tearDown(){}
+
+int main(){
+    UNITY_BEGIN();
+    RUN_TEST(test_stalled_reader_skips_fast_reader_gets_all);
+    RUN_TEST(test_chunked_part_framing);
+    return UNITY_END();
+}
@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+"""Print the per-frame detector results streamed by /dots.
+
+Usage:
+    tools/dots_client.py http://<cam>:81/dots
+
+Each line is one frame: frame counter, capture time, the selected track id
+and every dot as id:x,y,wxh/class.
+"""
+
+import argparse
+import socket
+import struct
+import urllib.parse
+
+RECORD = struct.Struct("<HHIQHHIB3x")
+DOT = struct.Struct("<IHHHHB")
+MAGIC = 0xD075
+
+
+def read_line(f):
+    line = f.readline()
+    if not line:
+        raise EOFError
+    return line.strip()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("url")
+    args = parser.parse_args()
+
+    url = urllib.parse.urlparse(args.url)
+    sock = socket.create_connection((url.hostname, url.port or 80))
+    sock.sendall(("GET %s HTTP/1.1\r\nHost: %s\r\n\r\n" % (url.path or "/dots", url.hostname)).encode())
+    f = sock.makefile("rb")
+
+    while read_line(f):
+        pass  # response headers
+    try:
+        while True:
+            size = int(read_line(f), 16)
+            chunk = f.read(size)
+            f.read(2)
+            magic, length, frame, timestamp, width, height, selected, count = RECORD.unpack_from(chunk)
+            if magic != MAGIC or length != size:
+                print("bad record")
+                continue
+            dots = []
+            for i in range(count):
+                dot_id, x, y, w, h, cls = DOT.unpack_from(chunk, RECORD.size + i * DOT.size)
+                dots.append("%d:%d,%d,%dx%d/%d" % (dot_id, x, y, w, h, cls))
+            print("%8d %10.3fs %dx%d sel %d  %s" % (frame, timestamp / 1e6, width, height, selected, " ".join(dots)))
+    except EOFError:
+        print("connection closed")
+
+
+if __name__ == "__main__":
+    main()
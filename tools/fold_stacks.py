@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""Symbolize a /profile dump against the firmware ELF and print folded stacks.
+
+Usage:
+    curl -s "http://<cam>/profile?cmd=start&hz=1000"; sleep 10
+    curl -s "http://<cam>/profile" > profile.txt
+    tools/fold_stacks.py .pio/build/esp32cam/firmware.elf profile.txt > out.folded
+    flamegraph.pl out.folded > out.svg
+
+Each dump line is "<core> <pc> <caller pc> ...", innermost frame first.
+"""
+
+import argparse
+import collections
+import subprocess
+import sys
+
+
+def symbolize(addr2line, elf, addresses):
+    addresses = sorted(addresses)
+    if not addresses:
+        return {}
+    out = subprocess.run(
+        [addr2line, "-f", "-C", "-e", elf] + ["0x%08x" % a for a in addresses],
+        check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout.splitlines()
+    names = {}
+    # addr2line prints two lines (function, file:line) per address
+    for i, addr in enumerate(addresses):
+        name = out[2 * i].strip() if 2 * i < len(out) else "??"
+        names[addr] = name if name != "??" else "0x%08x" % addr
+    return names
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="firmware ELF the dump was taken from")
+    parser.add_argument("dump", nargs="?", default="-", help="/profile output (default: stdin)")
+    parser.add_argument("--addr2line", default="xtensa-esp32-elf-addr2line")
+    parser.add_argument("--no-core", action="store_true", help="do not prefix stacks with the core")
+    args = parser.parse_args()
+
+    stream = sys.stdin if args.dump == "-" else open(args.dump)
+    stacks = []
+    for line in stream:
+        line = line.strip()
+        if not line or line.startswith("#"):
+            continue
+        fields = line.split()
+        stacks.append((int(fields[0]), [int(f, 16) for f in fields[1:]]))
+
+    names = symbolize(args.addr2line, args.elf, {pc for _, pcs in stacks for pc in pcs})
+    folded = collections.Counter()
+    for core, pcs in stacks:
+        frames = [names[pc] for pc in reversed(pcs)]
+        if not args.no_core:
+            frames.insert(0, "core%d" % core)
+        folded[";".join(frames)] += 1
+
+    for stack, count in folded.most_common():
+        print("%s %d" % (stack, count))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""Fetch frames from /raw and store them as a replay corpus.
+
+Usage:
+    tools/raw_reader.py http://<cam>/raw --out corpus --count 100 --interval 0.5
+    tools/raw_reader.py http://<cam>/raw?x=40&y=30&w=80&h=60 --out corpus
+    tools/raw_reader.py --show corpus/frame_000001.raw
+
+Every frame is written verbatim (header and pixels) as frame_NNNNNN.raw.
+RGB888 and grayscale frames also get a .ppm / .pgm preview.
+"""
+
+import argparse
+import os
+import struct
+import time
+import urllib.request
+
+HEADER = struct.Struct("<IHHHHHHHHHBBQ")
+MAGIC = 0x57415246
+FORMATS = {0: "RGB565", 1: "YUV422", 2: "GRAYSCALE", 3: "JPEG", 4: "RGB888"}
+
+
+def parse(data):
+    (magic, version, fmt, width, height, x, y, step,
+     frame_width, frame_height, bpp, _, timestamp) = HEADER.unpack_from(data)
+    if magic != MAGIC:
+        raise ValueError("not a /raw frame")
+    pixels = data[HEADER.size:]
+    if len(pixels) != width * height * bpp:
+        raise ValueError("truncated frame: %d of %d bytes" % (len(pixels), width * height * bpp))
+    return dict(version=version, format=fmt, width=width, height=height, x=x, y=y, step=step,
+                frame_width=frame_width, frame_height=frame_height, bpp=bpp, timestamp=timestamp), pixels
+
+
+def preview(path, info, pixels):
+    if info["format"] == 2:
+        with open(path + ".pgm", "wb") as f:
+            f.write(b"P5 %d %d 255\n" % (info["width"], info["height"]))
+            f.write(pixels)
+    elif info["format"] == 4:
+        # the camera stores RGB888 as B, G, R
+        rgb = bytearray(pixels)
+        rgb[0::3], rgb[2::3] = pixels[2::3], pixels[0::3]
+        with open(path + ".ppm", "wb") as f:
+            f.write(b"P6 %d %d 255\n" % (info["width"], info["height"]))
+            f.write(rgb)
+
+
+def describe(info):
+    return "%s %dx%d at %d,%d step %d of %dx%d, t=%.3fs" % (
+        FORMATS.get(info["format"], info["format"]), info["width"], info["height"], info["x"], info["y"],
+        info["step"], info["frame_width"], info["frame_height"], info["timestamp"] / 1e6)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("url", nargs="?")
+    parser.add_argument("--out", default="corpus")
+    parser.add_argument("--count", type=int, default=1)
+    parser.add_argument("--interval", type=float, default=0)
+    parser.add_argument("--show", help="print the header of a stored frame")
+    args = parser.parse_args()
+
+    if args.show:
+        with open(args.show, "rb") as f:
+            info, _ = parse(f.read())
+        print(describe(info))
+        return
+    if not args.url:
+        parser.error("url or --show is required")
+
+    os.makedirs(args.out, exist_ok=True)
+    for i in range(args.count):
+        data = urllib.request.urlopen(args.url).read()
+        info, pixels = parse(data)
+        path = os.path.join(args.out, "frame_%06d" % (i + 1))
+        with open(path + ".raw", "wb") as f:
+            f.write(data)
+        preview(path, info, pixels)
+        print("%s: %s" % (path, describe(info)))
+        if args.interval:
+            time.sleep(args.interval)
+
+
+if __name__ == "__main__":
+    main()
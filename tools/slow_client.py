@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+"""Read /stream like a viewer on a bad link and report the frames it gets.
+
+Usage:
+    tools/slow_client.py http://<cam>:81/stream --rate 20000   # 20 kB/s
+    tools/slow_client.py http://<cam>:81/stream                 # full speed
+
+Run a throttled and a full-speed client side by side: the fast one should
+keep its frame rate while the slow one skips frames.
+"""
+
+import argparse
+import socket
+import time
+import urllib.parse
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("url")
+    parser.add_argument("--rate", type=int, default=0, help="bytes per second to read, 0 for unlimited")
+    parser.add_argument("--seconds", type=float, default=30)
+    args = parser.parse_args()
+
+    url = urllib.parse.urlparse(args.url)
+    sock = socket.create_connection((url.hostname, url.port or 80))
+    # a small receive buffer makes the throttling visible to the sender
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+    sock.sendall(("GET %s HTTP/1.1\r\nHost: %s\r\n\r\n" % (url.path or "/", url.hostname)).encode())
+
+    start = time.time()
+    last_report = start
+    received = 0
+    frames = 0
+    marker = b"Content-Length:"
+    tail = b""
+    while time.time() - start < args.seconds:
+        data = sock.recv(1024)
+        if not data:
+            print("connection closed")
+            break
+        received += len(data)
+        # keep less than one marker of the previous read so none is counted twice
+        window = tail + data
+        frames += window.count(marker)
+        tail = window[-(len(marker) - 1):]
+        if args.rate:
+            time.sleep(len(data) / float(args.rate))
+        now = time.time()
+        if now - last_report >= 1:
+            print("%6.1fs %8d B %4d frames %6.1f kB/s" % (now - start, received, frames, received / (now - start) / 1000))
+            last_report = now
+    sock.close()
+
+
+if __name__ == "__main__":
+    main()